@@ -22,22 +22,22 @@ class aabb {
             return 2;
         }
 
-        float intersect(const ray& r, double tmin, double tmax) const {
+        real intersect(const ray& r, real tmin, real tmax) const {
             for (int a = 0; a < 3; a++) {
-                auto invD = 1.0f / r.direction()[a];
+                auto invD = 1 / r.direction()[a];
                 auto t0 = (min()[a] - r.origin()[a]) * invD;
                 auto t1 = (max()[a] - r.origin()[a]) * invD;
-                if (invD < 0.0f)
+                if (invD < 0)
                     std::swap(t0, t1);
                 tmin = t0 > tmin ? t0 : tmin;
                 tmax = t1 < tmax ? t1 : tmax;
                 if (tmax <= tmin)
-                    return -1.0f;
+                    return -1;
             }
             return tmin;
         }
 
-        float half_surface_area() const {
+        real half_surface_area() const {
             vec3 offset = _max - _min;
             return offset.x() * offset.y() + offset.y() * offset.z() + offset.z() * offset.x();
         }
@@ -0,0 +1,93 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A bump allocator for objects that live as long as the scene, like bvh nodes.
+// Memory is taken from large blocks and is only freed all at once when the arena
+// is destroyed, after the destructors of the objects that have one ran in reverse
+// order of allocation. Those are kept as runs of objects of the same type that lie
+// next to each other, mostly one per block.
+class arena {
+	public:
+		arena(size_t block_size = 256 * 1024) : block_size(block_size) {}
+
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+
+		~arena() {
+			for (auto run = destructors.rbegin(); run != destructors.rend(); ++run) {
+				for (auto i = run->count; i-- > 0;)
+					run->destroy(run->first + i * run->size);
+			}
+		}
+
+		void* allocate(size_t size, size_t align) {
+			auto p = align_up(reinterpret_cast<uintptr_t>(current), align);
+			if (current == nullptr || p + size > reinterpret_cast<uintptr_t>(end)) {
+				// objects bigger than a block get a block of their own
+				auto n = std::max(block_size, size + align);
+				blocks.emplace_back(new char[n]);
+				current = blocks.back().get();
+				end = current + n;
+				bytes_reserved += n;
+				p = align_up(reinterpret_cast<uintptr_t>(current), align);
+			}
+
+			current = reinterpret_cast<char*>(p + size);
+			return reinterpret_cast<void*>(p);
+		}
+
+		// The destructor is registered before the constructor runs, so when the
+		// constructor makes more objects (like a bvh node its children) they still
+		// extend the same run.
+		template <typename T, typename... Args>
+		T* make(Args&&... args) {
+			auto p = allocate(sizeof(T), alignof(T));
+			if constexpr (!std::is_trivially_destructible<T>::value)
+				add_destructor(p, sizeof(T), [](void* object) { static_cast<T*>(object)->~T(); });
+			return new (p) T(std::forward<Args>(args)...);
+		}
+
+		size_t reserved() const { return bytes_reserved; }
+
+	private:
+		struct destructor_run {
+			char* first;
+			size_t count;
+			size_t size;
+			void (*destroy)(void*);
+		};
+
+		void add_destructor(void* p, size_t size, void (*destroy)(void*)) {
+			auto object = static_cast<char*>(p);
+			if (!destructors.empty()) {
+				auto& run = destructors.back();
+				if (run.destroy == destroy && run.first + run.count * run.size == object) {
+					run.count++;
+					return;
+				}
+			}
+			destructors.push_back({ object, 1, size, destroy });
+		}
+
+		static uintptr_t align_up(uintptr_t p, size_t align) {
+			return (p + align - 1) & ~uintptr_t(align - 1);
+		}
+
+	private:
+		size_t block_size;
+		std::vector<std::unique_ptr<char[]>> blocks;
+		char* current = nullptr;
+		char* end = nullptr;
+		size_t bytes_reserved = 0;
+		std::vector<destructor_run> destructors;
+};
+
+#endif
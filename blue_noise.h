@@ -0,0 +1,128 @@
+#ifndef BLUE_NOISE_H
+#define BLUE_NOISE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "rtweekend.h"
+
+// A tileable blue noise mask: every value in [0,1) appears once and neighbouring
+// pixels have values far apart, so an error that follows the mask has no low
+// frequencies. It is made with the void and cluster method (Ulichney 1993) the
+// first time it is used, that takes a few tens of milliseconds for 64x64.
+class blue_noise_mask {
+	public:
+		static constexpr int size = 64;
+
+		static const blue_noise_mask& get() {
+			static const blue_noise_mask mask; // made once, thread safe
+			return mask;
+		}
+
+		real operator()(int x, int y) const {
+			return values[(y & (size - 1)) * size + (x & (size - 1))];
+		}
+
+	private:
+		blue_noise_mask() {
+			constexpr int n = size * size;
+			constexpr real sigma = 1.5;
+
+			// the gaussian energy one point adds to the pixels around it, on a torus
+			std::vector<real> kernel(n);
+			for (int y = 0; y < size; y++) {
+				for (int x = 0; x < size; x++) {
+					int dx = std::min(x, size - x);
+					int dy = std::min(y, size - y);
+					kernel[y * size + x] = std::exp(-(dx*dx + dy*dy) / (2 * sigma * sigma));
+				}
+			}
+
+			std::vector<uint8_t> points(n, 0);
+			std::vector<real> energy(n, 0);
+			auto update = [&](int p, real sign) {
+				const int px = p % size, py = p / size;
+				for (int y = 0; y < size; y++) {
+					const real* k = &kernel[((y - py) & (size - 1)) * size];
+					real* e = &energy[y * size];
+					for (int x = 0; x < size; x++)
+						e[x] += sign * k[(x - px) & (size - 1)];
+				}
+			};
+			// the point with the most energy, and the empty pixel with the least
+			auto tightest_cluster = [&]() {
+				int best = -1;
+				for (int p = 0; p < n; p++) {
+					if (points[p] && (best < 0 || energy[p] > energy[best]))
+						best = p;
+				}
+				return best;
+			};
+			auto largest_void = [&]() {
+				int best = -1;
+				for (int p = 0; p < n; p++) {
+					if (!points[p] && (best < 0 || energy[p] < energy[best]))
+						best = p;
+				}
+				return best;
+			};
+
+			// a random initial pattern of a tenth of the pixels
+			pcg32 rng(0x626c7565, 0x6e6f697365);
+			const int initial_count = n / 10;
+			for (int count = 0; count < initial_count; ) {
+				int p = rng.next_uint() % n;
+				if (!points[p]) {
+					points[p] = 1;
+					update(p, 1);
+					count++;
+				}
+			}
+
+			// move the point of the tightest cluster to the largest void until the point
+			// removed is the one put back
+			for (int i = 0; i < n; i++) {
+				int cluster = tightest_cluster();
+				points[cluster] = 0;
+				update(cluster, -1);
+				int gap = largest_void();
+				points[gap] = 1;
+				update(gap, 1);
+				if (gap == cluster)
+					break;
+			}
+
+			// rank the initial points by taking the tightest cluster away one by one
+			std::vector<int> rank(n, 0);
+			std::vector<uint8_t> initial = points;
+			std::vector<real> initial_energy = energy;
+			for (int r = initial_count - 1; r >= 0; r--) {
+				int cluster = tightest_cluster();
+				points[cluster] = 0;
+				update(cluster, -1);
+				rank[cluster] = r;
+			}
+
+			// then fill the largest void until every pixel has a rank, past half filled
+			// that is the tightest cluster of the empty pixels
+			points = initial;
+			energy = initial_energy;
+			for (int r = initial_count; r < n; r++) {
+				int gap = largest_void();
+				points[gap] = 1;
+				update(gap, 1);
+				rank[gap] = r;
+			}
+
+			values.resize(n);
+			for (int p = 0; p < n; p++)
+				values[p] = (rank[p] + real(0.5)) / n;
+		}
+
+	private:
+		std::vector<real> values;
+};
+
+#endif
@@ -11,51 +11,376 @@
 #include <cstring>
 
 #include "hittable.h"
+#include "hittable_list.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include "sphere.h"
+#include "triangle_block.h"
+#include "sphere_block.h"
+#include "arena.h"
+
+// The primitive types a leaf can intersect without going through the hittable vtable.
+// Everything that is not a triangle, a triangle of a mesh or a sphere is stored as a
+// plain hittable.
+enum class prim_type : uint8_t {
+	hittable,
+	triangle,
+	mesh_triangle,
+	quantized_triangle, // a triangle of a quantized mesh, decoded when it is intersected
+	sphere
+};
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
-	aabb box_a = a->bounding_box();
-	aabb box_b = b->bounding_box();
+// a triangle of a quantized triangle_mesh
+struct mesh_triangle_ref {
+	const triangle_mesh* mesh;
+	uint32_t index;
+};
 
-    return box_a.min().e[axis] < box_b.min().e[axis];
+// what the builder needs to know of a primitive, the triangles of a mesh get one each
+struct bvh_build_prim {
+	aabb box;
+	point3 centroid;
+	const hittable* object; // the primitive, or the mesh for a mesh triangle
+	uint32_t index;         // triangle index for a mesh triangle
+	prim_type type;
+};
+
+inline bool box_compare(const bvh_build_prim& a, const bvh_build_prim& b, int axis) {
+    return a.box.min().e[axis] < b.box.min().e[axis];
 }
 
-bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+bool box_x_compare(const bvh_build_prim& a, const bvh_build_prim& b) {
 	return box_compare(a, b, 0);
 }
 
-bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+bool box_y_compare(const bvh_build_prim& a, const bvh_build_prim& b) {
 	return box_compare(a, b, 1);
 }
 
-bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+bool box_z_compare(const bvh_build_prim& a, const bvh_build_prim& b) {
 	return box_compare(a, b, 2);
 }
 
+// max number of primitives in a leaf, below that the surface area heuristic decides
+// between a leaf and a split
+constexpr size_t bvh_max_leaf_size = 4 * simd_width;
+
+// Costs for the surface area heuristic, relative to the ray box tests of a node: a
+// primitive intersected on its own, and a block of simd_width primitives intersected
+// at once. A block costs the same however many of its lanes are used, so the
+// heuristic prefers splits that fill the blocks.
+constexpr float bvh_traversal_cost = 1;
+constexpr float bvh_primitive_cost = 1;
+constexpr float bvh_block_cost = 2;
+
+// the primitives of these types are put in blocks of simd_width
+inline bool bvh_uses_blocks(prim_type type) {
+	return type == prim_type::mesh_triangle || type == prim_type::sphere;
+}
+
+// the cost of intersecting count primitives, in blocks of granularity (1 for no blocks)
+inline float bvh_leaf_cost(size_t count, size_t granularity) {
+	if (granularity == 1)
+		return count * bvh_primitive_cost;
+	return (count + granularity - 1) / granularity * bvh_block_cost;
+}
+
+// The primitives of the tree, stored contiguously per type. They are appended in the
+// order the leaves are made (depth first), so neighbouring leaves are also neighbours
+// in memory. A leaf references a range [prim_first, prim_first + prim_count) of one type,
+// for mesh triangles the range is in triangle_blocks and for spheres in sphere_blocks,
+// for quantized triangles it is in mesh_triangles.
+struct bvh_primitives {
+	std::vector<triangle> triangles;
+	std::vector<triangle_block> triangle_blocks;   // a block refers to its mesh itself
+	std::vector<mesh_triangle_ref> mesh_triangles; // of the quantized leaves
+	std::vector<sphere> spheres;                   // indexed by sphere_block::prim
+	std::vector<sphere_block> sphere_blocks;
+	std::vector<const hittable*> hittables;
+
+	// keeps the meshes and other hittables the leaves point to alive
+	std::vector<shared_ptr<hittable>> owners;
+
+	// the nodes below the root, freed together with the tree
+	arena nodes;
+};
+
+// the build primitives of a list, meshes are split into their triangles
+std::vector<bvh_build_prim> bvh_build_prims(const hittable_list& list, bvh_primitives& storage) {
+	std::vector<bvh_build_prim> prims;
+
+	for (const auto& object : list.objects) {
+		if (auto mesh = dynamic_cast<const triangle_mesh*>(object.get())) {
+			storage.owners.push_back(object);
+			// the triangles of a quantized mesh are not copied into blocks of floats, that
+			// would undo the memory savings
+			auto type = mesh->quantized() ? prim_type::quantized_triangle : prim_type::mesh_triangle;
+			for (uint32_t i = 0; i < mesh->triangle_count(); i++)
+				prims.push_back({ mesh->triangle_bounding_box(i), mesh->triangle_centroid(i), mesh, i, type });
+			continue;
+		}
+
+		auto type = prim_type::hittable;
+		if (dynamic_cast<const triangle*>(object.get()))
+			type = prim_type::triangle;
+		else if (dynamic_cast<const sphere*>(object.get()))
+			type = prim_type::sphere;
+		else
+			storage.owners.push_back(object);
+
+		prims.push_back({ object->bounding_box(), object->centroid, object.get(), 0, type });
+	}
+
+	return prims;
+}
+
 class bvh_node : public hittable {
 	public:
 		bvh_node();
 
-		bvh_node(hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+		// The triangles and spheres of the list are copied into the tree, the list is
+		// emptied so they are not kept twice. Meshes and other hittables stay alive
+		// through the tree's owners.
+		bvh_node(hittable_list&& list) : primitives(make_shared<bvh_primitives>()) {
+			auto objects = bvh_build_prims(list, *primitives);
+			build(objects, 0, objects.size(), *primitives);
+			list.clear();
+			list.objects.shrink_to_fit();
+		}
 
-		bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end);
+		bvh_node(std::vector<bvh_build_prim>& objects, size_t start, size_t end, bvh_primitives& storage) {
+			build(objects, start, end, storage);
+		}
 
-		virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+		bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
         aabb bounding_box() const { return box; }
 
+        bool is_leaf() const { return prim_count > 0; }
+
+    private:
+        void build(std::vector<bvh_build_prim>& objects, size_t start, size_t end, bvh_primitives& storage);
+        bool same_type(const std::vector<bvh_build_prim>& objects, size_t start, size_t end) const;
+        bool can_make_leaf(const std::vector<bvh_build_prim>& objects, size_t start, size_t end) const;
+        void make_leaf(const std::vector<bvh_build_prim>& objects, size_t start, size_t end, bvh_primitives& storage);
+
     public:
-        shared_ptr<hittable> left;
-        shared_ptr<hittable> right;
+        const bvh_node* left = nullptr;
+        const bvh_node* right = nullptr;
         aabb box;
+
+        // the primitive arrays of the tree, used by the leaves and to fill the hit record
+        const bvh_primitives* prims = nullptr;
+
+        // leaf data
+        prim_type type = prim_type::hittable;
+        uint32_t prim_first = 0;
+        uint32_t prim_count = 0;
+
+        // only set on the root, owns the primitives of the whole tree
+        shared_ptr<bvh_primitives> primitives;
 };
 
+bool bvh_node::same_type(const std::vector<bvh_build_prim>& objects, size_t start, size_t end) const {
+	for (auto i = start + 1; i < end; i++) {
+		if (objects[i].type != objects[start].type)
+			return false;
+	}
+	return true;
+}
+
+// A range can become a leaf when it is not too big and all primitives have the same
+// type, whether it does is up to the surface area heuristic. Other hittables (like
+// out of core clusters) get a leaf each, so a ray only touches the ones whose box it
+// hits.
+bool bvh_node::can_make_leaf(const std::vector<bvh_build_prim>& objects, size_t start, size_t end) const {
+	if (end - start == 1)
+		return true;
+	if (end - start > bvh_max_leaf_size || objects[start].type == prim_type::hittable)
+		return false;
+	return same_type(objects, start, end);
+}
+
+// copy the primitives into the array of their type, so the leaf can call the
+// intersection routine of that type directly
+void bvh_node::make_leaf(const std::vector<bvh_build_prim>& objects, size_t start, size_t end, bvh_primitives& storage) {
+	D(num_bvh_leaf_nodes++);
+
+	type = objects[start].type;
+	box = objects[start].box;
+	for (auto i = start; i < end; i++)
+		box = surrounding_box(box, objects[i].box);
+
+	if (type == prim_type::mesh_triangle) {
+		// blocks with a triangle per lane, a block only holds triangles of one mesh so
+		// the leaf's triangles are grouped by mesh first
+		std::vector<size_t> order;
+		for (auto i = start; i < end; i++)
+			order.push_back(i);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return objects[a].object < objects[b].object; });
+
+		prim_first = storage.triangle_blocks.size();
+		int lane = simd_width;
+		for (auto i : order) {
+			const auto mesh = static_cast<const triangle_mesh*>(objects[i].object);
+			if (lane == simd_width || storage.triangle_blocks.back().mesh != mesh) {
+				storage.triangle_blocks.emplace_back();
+				storage.triangle_blocks.back().mesh = mesh;
+				lane = 0;
+			}
+			const auto tri = objects[i].index;
+			storage.triangle_blocks.back().set(lane++, mesh->vertex(tri, 0), mesh->vertex(tri, 1), mesh->vertex(tri, 2), tri);
+		}
+		prim_count = storage.triangle_blocks.size() - prim_first;
+		return;
+	}
+
+	if (type == prim_type::sphere) {
+		// the same for spheres, the lanes refer back to the copied spheres
+		prim_first = storage.sphere_blocks.size();
+		for (auto i = start; i < end; i++) {
+			if ((i - start) % simd_width == 0)
+				storage.sphere_blocks.emplace_back();
+			const auto& sph = *static_cast<const sphere*>(objects[i].object);
+			storage.sphere_blocks.back().set((i - start) % simd_width, sph.center, sph.radius, storage.spheres.size());
+			storage.spheres.push_back(sph);
+		}
+		prim_count = storage.sphere_blocks.size() - prim_first;
+		return;
+	}
+
+	switch (type) {
+		case prim_type::triangle:
+			prim_first = storage.triangles.size();
+			for (auto i = start; i < end; i++)
+				storage.triangles.push_back(*static_cast<const triangle*>(objects[i].object));
+			break;
+		case prim_type::quantized_triangle:
+			prim_first = storage.mesh_triangles.size();
+			for (auto i = start; i < end; i++)
+				storage.mesh_triangles.push_back({ static_cast<const triangle_mesh*>(objects[i].object), objects[i].index });
+			break;
+		case prim_type::hittable:
+			prim_first = storage.hittables.size();
+			for (auto i = start; i < end; i++)
+				storage.hittables.push_back(objects[i].object);
+			break;
+		case prim_type::mesh_triangle:
+		case prim_type::sphere:
+			break;
+	}
+	prim_count = end - start;
+}
+
+// The closest hit found so far while traversing the tree. Only the distance,
+// barycentric coordinates and primitive are kept, the hit record is filled once
+// for the final closest hit. Other hittables fill the hit record themselves,
+// for those it is already complete when they are the closest.
+struct bvh_hit {
+	real t;
+	real u, v;
+	prim_type type;
+	uint32_t index;    // triangle, hittable or quantized triangle, for spheres the index from the block, for mesh triangles the block
+	uint32_t lane = 0; // of the block, for mesh triangles
+};
+
+// intersect the primitives of a leaf, the type specific intersection functions are
+// called non-virtually so they can be inlined
+inline bool hit_leaf(const bvh_node* node, const ray& r, real t_min, real t_max, bvh_hit& hit, hit_record& rec) {
+	const auto& prims = *node->prims;
+	const auto end = node->prim_first + node->prim_count;
+	bool hit_anything = false;
+	real t, u, v;
+
+	switch (node->type) {
+		case prim_type::triangle:
+			for (auto i = node->prim_first; i < end; i++) {
+				const auto& tri = prims.triangles[i];
+				if (intersect_triangle(tri.v0, tri.v1, tri.v2, r, t_min, t_max, t, u, v)) {
+					hit = { t, u, v, prim_type::triangle, i };
+					hit_anything = true;
+					t_max = t;
+				}
+			}
+			break;
+		case prim_type::mesh_triangle:
+			for (auto i = node->prim_first; i < end; i++) {
+				const auto& block = prims.triangle_blocks[i];
+				auto lane = intersect_triangle_block(block, r, t_min, t_max, t, u, v);
+				if (lane >= 0) {
+					hit = { t, u, v, prim_type::mesh_triangle, i, (uint32_t)lane };
+					hit_anything = true;
+					t_max = t;
+				}
+			}
+			break;
+		case prim_type::quantized_triangle:
+			for (auto i = node->prim_first; i < end; i++) {
+				const auto& ref = prims.mesh_triangles[i];
+				if (ref.mesh->intersect(ref.index, r, t_min, t_max, t, u, v)) {
+					hit = { t, u, v, prim_type::quantized_triangle, i };
+					hit_anything = true;
+					t_max = t;
+				}
+			}
+			break;
+		case prim_type::sphere:
+			for (auto i = node->prim_first; i < end; i++) {
+				const auto& block = prims.sphere_blocks[i];
+				auto lane = intersect_sphere_block(block, r, t_min, t_max, t);
+				if (lane >= 0) {
+					hit = { t, 0, 0, prim_type::sphere, block.prim[lane] };
+					hit_anything = true;
+					t_max = t;
+				}
+			}
+			break;
+		case prim_type::hittable:
+			for (auto i = node->prim_first; i < end; i++) {
+				if (prims.hittables[i]->hit(r, t_min, t_max, rec)) {
+					hit = { rec.t, 0, 0, prim_type::hittable, i };
+					hit_anything = true;
+					t_max = rec.t;
+				}
+			}
+			break;
+	}
+
+	return hit_anything;
+}
+
+// fill the hit record for the closest hit
+inline void set_hit_record(const bvh_primitives& prims, const bvh_hit& hit, const ray& r, hit_record& rec) {
+	switch (hit.type) {
+		case prim_type::triangle:
+			prims.triangles[hit.index].set_hit_record(r, hit.t, hit.u, hit.v, rec);
+			break;
+		case prim_type::mesh_triangle: {
+			const auto& block = prims.triangle_blocks[hit.index];
+			block.mesh->set_hit_record(block.prim[hit.lane], r, hit.t, hit.u, hit.v, rec);
+			break;
+		}
+		case prim_type::quantized_triangle: {
+			const auto& ref = prims.mesh_triangles[hit.index];
+			ref.mesh->set_hit_record(ref.index, r, hit.t, hit.u, hit.v, rec);
+			break;
+		}
+		case prim_type::sphere:
+			prims.spheres[hit.index].set_hit_record(r, hit.t, rec);
+			break;
+		case prim_type::hittable:
+			break;
+	}
+}
+
 // return the surface area heuristic of the specific split plane.
 // left:     The number of primitives in the left node to be split.
 // right:    The number of primitives in the right node to be split.
 // lbox:     Bounding box of the left node to be split.
 // rbox:     Bounding box of the right node to be split.
 // box:      Bounding box of the current node.
-float sah(unsigned left, unsigned right, const aabb& lbox, const aabb& rbox , const aabb& box ) {
-    return (left * lbox.half_surface_area() + right * rbox.half_surface_area()) / box.half_surface_area();
+// granularity: The primitives are intersected in blocks of this many, see bvh_leaf_cost.
+float sah(unsigned left, unsigned right, const aabb& lbox, const aabb& rbox , const aabb& box, size_t granularity) {
+    return (bvh_leaf_cost(left, granularity) * lbox.half_surface_area() + bvh_leaf_cost(right, granularity) * rbox.half_surface_area()) / box.half_surface_area();
 }
 
 // pick the best split based on the surface area heuristic
@@ -64,17 +389,18 @@ float sah(unsigned left, unsigned right, const aabb& lbox, const aabb& rbox , co
 float pick_best_split(
 	int& axis,
 	float& split_pos,
-	std::vector<shared_ptr<hittable>>& primitives,
+	std::vector<bvh_build_prim>& primitives,
 	const aabb& node_aabb,
 	const size_t start,
-	const size_t end)
+	const size_t end,
+	const size_t granularity)
 {
 	static constexpr unsigned BVH_SPLIT_COUNT = 16;
 
 	// centroid bounds
 	aabb inner;
 	for (auto i = start; i < end; i++) {
-		inner = surrounding_box(inner, primitives[i]->centroid);
+		inner = surrounding_box(inner, primitives[i].centroid);
 	}
 
 	auto primitive_num = end - start;
@@ -94,15 +420,14 @@ float pick_best_split(
 	auto split_delta = (inner._max[axis] - inner._min[axis]) / BVH_SPLIT_COUNT;
 	if (split_delta == 0.0f) {
 		split_pos = (inner._min[axis] + inner._max[axis]) / 2;
-		std::cout << "pick_best_split: fix this! -----------------------------\n";
 		return min_sah;
 	}
 	auto inv_split_delta = 1.0f / split_delta;
 	for (auto i = start; i < end ; i++) {
-		auto index = (int)((primitives[i]->centroid[axis] - split_start) * inv_split_delta);
+		auto index = (int)((primitives[i].centroid[axis] - split_start) * inv_split_delta);
 	    index = std::min(index, (int)(BVH_SPLIT_COUNT - 1));
 	    ++bin[index];
-	    bbox[index] = surrounding_box(bbox[index], primitives[i]->bounding_box());
+	    bbox[index] = surrounding_box(bbox[index], primitives[i].box);
 	}
 
 	// determine the best split pos of the 16 splits
@@ -116,7 +441,7 @@ float pick_best_split(
 	auto    pos = split_delta + split_start;
 	// check the sah value for all 16 split pane positions from begin to end
 	for (unsigned i = 0; i < BVH_SPLIT_COUNT - 1; i++) {
-	    auto sah_value = sah(left, primitive_num - left, lbox, rbox[i], node_aabb);
+	    auto sah_value = sah(left, primitive_num - left, lbox, rbox[i], node_aabb, granularity);
 	    if (sah_value < min_sah) {
 	        min_sah = sah_value;
 	        split_pos = pos;
@@ -131,39 +456,39 @@ float pick_best_split(
 
 
 #ifdef BVH_SPLIT_SAH
-bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+void bvh_node::build(std::vector<bvh_build_prim>& objects, size_t start, size_t end, bvh_primitives& storage) {
 	D(num_bvh_nodes++);
 
+	prims = &storage;
+
 	// generate the bounding box for the node
-	box = objects[start]->bounding_box();
+	box = objects[start].box;
     for (auto i = start; i < end; i++) {
-        box = surrounding_box(box, objects[i]->bounding_box());
+        box = surrounding_box(box, objects[i].box);
     }
 
 	size_t object_span = end - start;
 
-	// make a leaf node
 	if (object_span == 1) {
-		D(num_bvh_leaf_nodes++);
-		left = objects[start];
-		right = nullptr;
-
-		box = left->bounding_box();
+		make_leaf(objects, start, end, storage);
 		return;
 	}
 
-	// pick best split plane
+	// pick best split plane, with block costs when the primitives would be in blocks
+	const size_t granularity = bvh_uses_blocks(objects[start].type) && same_type(objects, start, end) ? simd_width : 1;
     int split_axis;
     float split_pos;
-    const auto sah = pick_best_split(split_axis, split_pos, objects, box, start, end);
+    const auto sah = pick_best_split(split_axis, split_pos, objects, box, start, end, granularity);
 
-    if (sah >= object_span){
-        std::cout << "sah: fix this! -----------------------------\n";
-    }
+	// make a leaf node when that is cheaper than the split
+	if (can_make_leaf(objects, start, end) && bvh_leaf_cost(object_span, granularity) <= bvh_traversal_cost + sah) {
+		make_leaf(objects, start, end, storage);
+		return;
+	}
 
     // partition the data
-    auto compare = [split_pos, split_axis](const shared_ptr<hittable> pri) {
-    	return pri->centroid.e[split_axis] < split_pos;
+    auto compare = [split_pos, split_axis](const bvh_build_prim& pri) {
+    	return pri.centroid.e[split_axis] < split_pos;
     };
     auto middle = std::partition(objects.begin() + start, objects.begin() + end, compare);
     auto mid = (unsigned)(middle - objects.begin());
@@ -171,45 +496,35 @@ bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, siz
     // To avoid degenerated node that has nothing in it.
     // it is possible to pick one with no primitive on one side of the plane,
     // resulting a crash later during ray tracing.
+    // This happens when all centroids are at the same position on the split axis
+    // (for example duplicate triangles), fall back to a median split.
     if (mid == start || mid == end) {
-		std::cout << "bvh error: fix this! -----------------------------\n";
-		// std::cout << "mid == start!\n";
-		// std::cout << "split_axis " << split_axis << "\n";
-		// std::cout << box.min() << " -------- " << box.max() << "\n";
-		// std::cout << " num children " << object_span << "\n";
-		// for (auto i = start; i < end; i++) {
-		// 	std::cout << "centroid: " << objects[i]->centroid.e[split_axis] << "\n";
-		// 	box = surrounding_box(box, objects[i]->bounding_box());
-		// }
-		// std::cout << "end -----------------------------------------------\n";
-		// auto comparator = (split_axis == 0) ? box_x_compare
-		// 				: (split_axis == 1) ? box_y_compare
-		// 									: box_z_compare;
-
-		// std::sort(objects.begin() + start, objects.begin() + end, comparator);
-		// mid = start + object_span / 2;
+		auto comparator = (split_axis == 0) ? box_x_compare
+						: (split_axis == 1) ? box_y_compare
+											: box_z_compare;
+
+		std::sort(objects.begin() + start, objects.begin() + end, comparator);
+		mid = start + object_span / 2;
     }
 
-	left = make_shared<bvh_node>(objects, start, mid);
-	right = make_shared<bvh_node>(objects, mid, end);
+	left = storage.nodes.make<bvh_node>(objects, start, mid, storage);
+	right = storage.nodes.make<bvh_node>(objects, mid, end, storage);
 
 	aabb box_left = left->bounding_box();
 	aabb box_right = right->bounding_box();
 	box = surrounding_box(box_left, box_right);
 }
 #elif defined BVH_SPLIT_MEDIAN
-bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+void bvh_node::build(std::vector<bvh_build_prim>& objects, size_t start, size_t end, bvh_primitives& storage) {
 	D(num_bvh_nodes++);
 
-	size_t object_span = end - start;
+	prims = &storage;
 
-	// make a leaf node
-	if (object_span == 1) {
-		D(num_bvh_leaf_nodes++);
-		left = objects[start];
-		right = nullptr;
+	size_t object_span = end - start;
 
-		box = left->bounding_box();
+	// make a leaf node, of at most a block since there are no costs to go by
+	if (can_make_leaf(objects, start, end) && object_span <= simd_width) {
+		make_leaf(objects, start, end, storage);
 		return;
 	}
 
@@ -220,8 +535,8 @@ bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, siz
 
 	std::sort(objects.begin() + start, objects.begin() + end, comparator);
 	auto mid = start + object_span / 2;
-	left = make_shared<bvh_node>(objects, start, mid);
-	right = make_shared<bvh_node>(objects, mid, end);
+	left = storage.nodes.make<bvh_node>(objects, start, mid, storage);
+	right = storage.nodes.make<bvh_node>(objects, mid, end, storage);
 
 	aabb box_left = left->bounding_box();
 	aabb box_right = right->bounding_box();
@@ -231,42 +546,41 @@ bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, siz
 
 
 #ifdef BVH_RECURSIVE_SLOW
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool traverse(const bvh_node* node, const ray& r, real t_min, real t_max, bvh_hit& hit, hit_record& rec) {
 
 	#ifdef DEBUG
 	num_ray_bvh_aabb_tests++;
-	if (right == nullptr) {
+	if (node->is_leaf()) {
 		num_ray_bvh_leaf_tests++;
 	}
 	#endif
 
-	float fmin = box.intersect(r, t_min, t_max);
+	real fmin = node->box.intersect(r, t_min, t_max);
 	if (fmin < 0.0f)
 		return false;
 
 	#ifdef DEBUG
 	rec.num_bvh_node_intersects++;
 	num_ray_bvh_aabb_intersections++;
-	if (right == nullptr) {
+	if (node->is_leaf()) {
 		num_ray_bvh_leaf_intersections++;
 	}
 	#endif
 
-	// if their is no right child, this is a leaf node
-	if (right == nullptr)
-		return left->hit(r, t_min, t_max, rec);
+	if (node->is_leaf())
+		return hit_leaf(node, r, t_min, t_max, hit, rec);
 
-	bool hit_left = left->hit(r, t_min, t_max, rec);
-	bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+	bool hit_left = traverse(node->left, r, t_min, t_max, hit, rec);
+	bool hit_right = traverse(node->right, r, t_min, hit_left ? hit.t : t_max, hit, rec);
 
 	return hit_left || hit_right;
 }
 #elif defined BVH_RECURSIVE_FAST
-bool traverse_node(const bvh_node* node, const ray& r, double t_min, double t_max, hit_record& rec) {
+bool traverse_node(const bvh_node* node, const ray& r, real t_min, real t_max, bvh_hit& hit, hit_record& rec) {
 
 	#ifdef DEBUG
 	num_ray_bvh_aabb_tests++;
-	if (node->right == nullptr)
+	if (node->is_leaf())
 		num_ray_bvh_leaf_tests++;
 	#endif
 
@@ -278,21 +592,20 @@ bool traverse_node(const bvh_node* node, const ray& r, double t_min, double t_ma
 	#ifdef DEBUG
 	rec.num_bvh_node_intersects++;
 	num_ray_bvh_aabb_intersections++;
-	if (node->right == nullptr)
+	if (node->is_leaf())
 		num_ray_bvh_leaf_intersections++;
 	#endif
 
-	// if their is no right child, this is a leaf node
-	if (node->right == nullptr)
-		return node->left->hit(r, t_min, t_max, rec);
+	if (node->is_leaf())
+		return hit_leaf(node, r, t_min, t_max, hit, rec);
 
 	// bool hit_left = left->hit(r, t_min, t_max, rec);
 	// bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
 
 	// return hit_left || hit_right;
 
-	const auto node_left = (bvh_node*)node->left.get();
-	const auto node_right = (bvh_node*)node->right.get();
+	const auto node_left = node->left;
+	const auto node_right = node->right;
 
 	const auto fmin0 = node_left->box.intersect(r, t_min, t_max);
     const auto fmin1 = node_right->box.intersect(r, t_min, t_max);
@@ -300,82 +613,87 @@ bool traverse_node(const bvh_node* node, const ray& r, double t_min, double t_ma
     auto inter = false;
 	if (fmin1 > fmin0) {
 		if (fmin0 >= 0.0f)
-			inter |= traverse_node(node_left, r, t_min, t_max, rec);
-		// if (inter && rec.t < fmin0)
+			inter |= traverse_node(node_left, r, t_min, t_max, hit, rec);
+		// if (inter && hit.t < fmin0)
 		// 	return true;
 		if (fmin1 >= 0.0f)
-			inter |= traverse_node(node_right, r, t_min, inter ? rec.t : t_max, rec);
+			inter |= traverse_node(node_right, r, t_min, inter ? hit.t : t_max, hit, rec);
 	} else {
 		if (fmin1 >= 0.0f)
-			inter |= traverse_node(node_right, r, t_min, t_max, rec);
-		// if (inter && rec.t < fmin1)
+			inter |= traverse_node(node_right, r, t_min, t_max, hit, rec);
+		// if (inter && hit.t < fmin1)
 		// 	return true;
 		if (fmin0 >= 0.0f)
-			inter |= traverse_node(node_left, r, t_min, inter ? rec.t : t_max, rec);
+			inter |= traverse_node(node_left, r, t_min, inter ? hit.t : t_max, hit, rec);
 	}
 
 	return inter;
 }
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool traverse(const bvh_node* root, const ray& r, real t_min, real t_max, bvh_hit& hit, hit_record& rec) {
 
-	const auto fmin = box.intersect(r, t_min, t_max);
+	const auto fmin = root->box.intersect(r, t_min, t_max);
 	if (fmin < 0.0f)
 		return false;
 
-	return traverse_node(this, r, t_min, t_max, rec);
+	return traverse_node(root, r, t_min, t_max, hit, rec);
 }
 #elif defined BVH_ITERATIVE
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	float fmin = box.intersect(r, t_min, t_max);
+bool traverse(const bvh_node* root, const ray& r, real t_min, real t_max, bvh_hit& hit, hit_record& rec) {
+	real fmin = root->box.intersect(r, t_min, t_max);
 	if (fmin < 0.0f)
 		return false;
 
-	static hittable* bvh_stack[100];
-	static hittable* candidate_list[100];
+	if (root->is_leaf())
+		return hit_leaf(root, r, t_min, t_max, hit, rec);
+
+	static const bvh_node* bvh_stack[100];
+	static const bvh_node* candidate_list[100];
 	size_t candidate_count = 0;
 
 	// stack index
 	auto si = 0;
-	bvh_stack[si++] = left.get();
-	bvh_stack[si++] = right.get();
+	bvh_stack[si++] = root->left;
+	bvh_stack[si++] = root->right;
 
 	// create candidate list
 	while (si > 0) {
-		const auto node = (bvh_node*)(bvh_stack[--si]);
+		const auto node = bvh_stack[--si];
 
-		float fmin = node->box.intersect(r, t_min, t_max);
+		real fmin = node->box.intersect(r, t_min, t_max);
 		if (fmin < 0.0f)
 			continue;
 
 		// if child is leaf add to candidate list
-		if (node->right == nullptr) {
-			candidate_list[candidate_count++] = node->left.get();
+		if (node->is_leaf()) {
+			candidate_list[candidate_count++] = node;
 			continue;
 		}
 
-		bvh_stack[si++] = node->left.get();
-		bvh_stack[si++] = node->right.get();
+		bvh_stack[si++] = node->left;
+		bvh_stack[si++] = node->right;
 	}
 
 	if (candidate_count == 0)
 		return false;
 
-	// iterative candidate tests
-	bool any_hit = candidate_list[0]->hit(r, t_min, t_max, rec);
-	for (size_t i = 1; i < candidate_count; i++) {
-		hit_record this_rec;
-		bool this_hit = candidate_list[i]->hit(r, t_min, t_max, this_rec);
-		if (this_hit && (!any_hit || this_rec.t < rec.t)) {
+	// iterative candidate tests, a leaf only reports hits closer than the closest so far
+	bool any_hit = false;
+	for (size_t i = 0; i < candidate_count; i++) {
+		if (hit_leaf(candidate_list[i], r, t_min, any_hit ? hit.t : t_max, hit, rec))
 			any_hit = true;
-			rec = this_rec;
-		}
 	}
 
-	if (any_hit)
-		return true;
-
-	return false;
+	return any_hit;
 }
 #endif
 
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	bvh_hit closest;
+	if (!traverse(this, r, t_min, t_max, closest, rec))
+		return false;
+
+	set_hit_record(*prims, closest, r, rec);
+	return true;
+}
+
 #endif
\ No newline at end of file
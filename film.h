@@ -0,0 +1,131 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "rtweekend.h"
+
+// comment out to spend the same number of samples on every pixel
+#define ADAPTIVE_SAMPLING
+
+// The sums of the samples of every pixel, with the sums of the luminances and the
+// squared luminances next to it to estimate the variance of the pixel mean. Those
+// are in double: the variance is their difference, in float it cancels at the
+// sample counts adaptive sampling goes to. Adaptive sampling works on tiles of
+// tile_size x tile_size pixels: a tile stops taking samples once the mean error of
+// its pixels is below the threshold, then the render loop spends its samples on the
+// tiles that are still noisy.
+class film {
+	public:
+		static constexpr int tile_size = 8;
+
+		film(size_t width, size_t height)
+			: width(width), height(height),
+			  tiles_x((width + tile_size - 1) / tile_size), tiles_y((height + tile_size - 1) / tile_size),
+			  sum(width * height), luminance_sum(width * height), luminance2_sum(width * height), samples(width * height), tile_active(tiles_x * tiles_y) {
+			clear();
+		}
+
+		void clear() {
+			std::fill(sum.begin(), sum.end(), color(0, 0, 0));
+			std::fill(luminance_sum.begin(), luminance_sum.end(), 0.0);
+			std::fill(luminance2_sum.begin(), luminance2_sum.end(), 0.0);
+			std::fill(samples.begin(), samples.end(), 0);
+			std::fill(tile_active.begin(), tile_active.end(), 1);
+			active_tiles = tiles_x * tiles_y;
+		}
+
+		// idx counts rows from the top, like the image
+		void add(size_t idx, const color& c) {
+			const double y = luminance(c);
+			sum[idx] += c;
+			luminance_sum[idx] += y;
+			luminance2_sum[idx] += y * y;
+			samples[idx]++;
+		}
+
+		bool active(size_t x, size_t y) const {
+			return tile_active[(y / tile_size) * tiles_x + x / tile_size];
+		}
+
+		// Standard error of the mean luminance of a pixel, after the gamma 2 of
+		// rgb_from_hdr, where d sqrt(y) = dy / (2 sqrt(y)). That is about the noise
+		// seen on screen, a dark pixel needs less absolute error than a bright one.
+		real error(size_t idx) const {
+			const uint32_t n = samples[idx];
+			if (n < 2)
+				return infinity;
+			const double mean = luminance_sum[idx] / n;
+			const double variance = std::max(0.0, (luminance2_sum[idx] - mean * luminance_sum[idx]) / (n - 1));
+			return real(std::sqrt(variance / n) / (2 * std::sqrt(std::max(mean, 1e-6))));
+		}
+
+		// Stop sampling the tiles where the mean error of the pixels is below threshold,
+		// returns the number of tiles still active. Tiles are never turned on again.
+		// The mean and not the largest error of the tile: the variance estimate of a
+		// single pixel is itself noisy, the largest one would keep almost every tile on.
+		size_t update_tiles(real threshold) {
+			for (size_t t = 0; t < tile_active.size(); t++) {
+				if (!tile_active[t])
+					continue;
+				const size_t x0 = (t % tiles_x) * tile_size, y0 = (t / tiles_x) * tile_size;
+				const size_t x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+				real total = 0;
+				for (size_t y = y0; y < y1; y++) {
+					for (size_t x = x0; x < x1; x++)
+						total += error(y * width + x);
+				}
+				if (total < threshold * ((x1 - x0) * (y1 - y0))) {
+					tile_active[t] = 0;
+					active_tiles--;
+				}
+			}
+			return active_tiles;
+		}
+
+		// the mean of error over the image, to report and for an error target
+		real mean_error() const {
+			double total = 0;
+			for (size_t i = 0; i < samples.size(); i++)
+				total += error(i);
+			return real(total / samples.size());
+		}
+
+		// the pixels the next pass takes a sample in
+		size_t active_pixels() const {
+			size_t count = 0;
+			for (size_t t = 0; t < tile_active.size(); t++) {
+				if (tile_active[t]) {
+					const size_t x0 = (t % tiles_x) * tile_size, y0 = (t / tiles_x) * tile_size;
+					count += (std::min(x0 + tile_size, width) - x0) * (std::min(y0 + tile_size, height) - y0);
+				}
+			}
+			return count;
+		}
+
+		size_t total_samples() const {
+			size_t total = 0;
+			for (auto n : samples)
+				total += n;
+			return total;
+		}
+
+		static real luminance(const color& c) {
+			return real(0.2126) * c.x() + real(0.7152) * c.y() + real(0.0722) * c.z();
+		}
+
+	public:
+		size_t width, height;
+		size_t tiles_x, tiles_y;
+		std::vector<color> sum;
+		std::vector<double> luminance_sum;
+		std::vector<double> luminance2_sum;
+		std::vector<uint32_t> samples;
+		std::vector<uint8_t> tile_active;
+		size_t active_tiles = 0;
+};
+
+#endif
@@ -8,9 +8,10 @@ class material;
 
 struct hit_record {
 	point3 p;
-	vec3 normal;
-	shared_ptr<material> mat_ptr;
-	double t;
+	vec3 normal;           // shading normal, for scattering
+	vec3 geometric_normal; // of the surface itself, for offsetting rays, see spawn_ray
+	uint32_t mat_id; // index in scene_materials
+	real t;
 	bool front_face;
 
 	#ifdef DEBUG
@@ -20,13 +21,16 @@ struct hit_record {
 	inline void set_face_normal(const ray& r, const vec3& outward_normal) {
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
+		geometric_normal = normal;
 	}
 };
 
 class hittable {
 	public:
+		virtual ~hittable() = default;
+
 		point3 centroid;
-		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
 		virtual aabb bounding_box() const = 0;
 };
 
@@ -19,27 +19,29 @@ class hittable_list: public hittable {
         }
 
         void add(shared_ptr<hittable> object) {
-            objects.push_back(object);
+            objects.push_back(std::move(object));
         }
 
-        void add(hittable_list objects_to_add) {
-            for (const auto& object : objects_to_add.objects) {
-                add(object);
-            }
+        void add(const hittable_list& objects_to_add) {
+            objects.insert(objects.end(), objects_to_add.objects.begin(), objects_to_add.objects.end());
+        }
+
+        void add(hittable_list&& objects_to_add) {
+            objects.insert(objects.end(), std::make_move_iterator(objects_to_add.objects.begin()), std::make_move_iterator(objects_to_add.objects.end()));
         }
 
-        //virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+        //virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
 
-        bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-            hit_record temp_rec;
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+            // objects only write the hit record when they report a closer hit,
+            // so it is not copied through a temporary
             bool hit_anything = false;
             auto closest_so_far = t_max;
 
             for (const auto& object : objects) {
-                if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+                if (object->hit(r, t_min, closest_so_far, rec)) {
                     hit_anything = true;
-                    closest_so_far = temp_rec.t;
-                    rec = temp_rec;
+                    closest_so_far = rec.t;
                 }
             }
 
@@ -0,0 +1,86 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read only memory mapping of a whole file. The pages are loaded by the OS on
+// first access, advise() can be used to hint which ranges are needed or can be
+// dropped from the resident set.
+class mapped_file {
+	public:
+		mapped_file() {}
+		mapped_file(const std::string& filename) { open(filename); }
+		~mapped_file() { close(); }
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		bool open(const std::string& filename) {
+			close();
+
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if (fd < 0) {
+				std::cerr << "mapped_file: could not open " << filename << "\n";
+				return false;
+			}
+
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size == 0) {
+				std::cerr << "mapped_file: could not stat " << filename << " or it is empty\n";
+				::close(fd);
+				return false;
+			}
+
+			void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd); // the mapping keeps its own reference to the file
+			if (ptr == MAP_FAILED) {
+				std::cerr << "mapped_file: could not map " << filename << "\n";
+				return false;
+			}
+
+			_data = static_cast<const char*>(ptr);
+			_size = st.st_size;
+			return true;
+		}
+
+		void close() {
+			if (_data)
+				munmap(const_cast<char*>(_data), _size);
+			_data = nullptr;
+			_size = 0;
+		}
+
+		// ask the OS to start reading the range in
+		void will_need(size_t offset, size_t length) const {
+			advise(offset, length, MADV_WILLNEED);
+		}
+
+		// drop the range from the resident set, the next access reads it from the file again
+		void dont_need(size_t offset, size_t length) const {
+			advise(offset, length, MADV_DONTNEED);
+		}
+
+		bool is_open() const { return _data != nullptr; }
+		const char* data() const { return _data; }
+		size_t size() const { return _size; }
+
+	private:
+		void advise(size_t offset, size_t length, int advice) const {
+			// madvise needs a page aligned start address
+			static const size_t page_size = sysconf(_SC_PAGESIZE);
+			size_t begin = offset / page_size * page_size;
+			madvise(const_cast<char*>(_data) + begin, offset + length - begin, advice);
+		}
+
+	private:
+		const char* _data = nullptr;
+		size_t _size = 0;
+};
+
+#endif
@@ -1,27 +1,113 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+//#define MATERIAL_VIRTUAL // call the built-in materials through the vtable too
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
 #include "rtweekend.h"
 
-struct hit_record;
+#include "hittable.h"
+#include "sampler.h"
+#include "sampling.h"
+
+
+// Start a ray at the hit point, offset to the side of the surface the ray leaves to.
+// That is the side of the geometric normal: the error bounds of the offset are along
+// it, and an interpolated shading normal can point to the other side at grazing angles.
+inline ray spawn_ray(const hit_record& rec, const vec3& direction) {
+	auto n = dot(direction, rec.geometric_normal) > 0 ? rec.geometric_normal : -rec.geometric_normal;
+	return ray(offset_ray_origin(rec.p, n), direction);
+}
+
 
+// The built-in material types, so ray_color can call them without the vtable.
+// Materials defined elsewhere are "other" and use the virtual functions. The
+// built-in classes are final: a subclass would keep their tag and the switch would
+// skip its overrides, a variant of one is a new material deriving from material.
+enum class material_type : uint8_t { lambertian, metal, dielectric, diffuse_light, other };
 
 class material {
 	public:
+		material(material_type type = material_type::other) : type(type) {}
+
 		virtual color emitted(  ) const {
 			return color(0, 0, 0);
 		};
-		virtual bool scatter( const ray&r_in, const hit_record& rec, color& attenuation, ray& scattered ) const = 0;
+		// the numbers a material needs come from the sampler, it is at the dimensions
+		// of the bounce, see sampler.h
+		virtual bool scatter( const ray&r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& smp ) const = 0;
+
+	public:
+		material_type type;
 };
 
 
-class lambertian : public material {
+// The materials of the scene. Primitives and hit records refer to a material by
+// its index in the table, so a hit does not update a shared_ptr reference count
+// that all threads are writing to. The table keeps the materials alive.
+// Materials can be added from several threads, also while other threads render
+// (the background build of stream_assets), so lookups are not locked. That works
+// because a material never moves: the table is a list of chunks, each twice as
+// big as the one before, and a chunk is never reallocated.
+class material_table {
 	public:
-		lambertian(const color& a) : albedo(a) {}
+		// adding a material that is already in the table returns its index
+		uint32_t add(const shared_ptr<material>& m) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = ids.find(m.get());
+			if (it != ids.end())
+				return it->second;
+
+			const uint32_t id = count.load(std::memory_order_relaxed);
+			const auto [chunk, offset] = locate(id);
+			if (!chunks[chunk])
+				chunks[chunk] = std::make_unique<shared_ptr<material>[]>(first_chunk_size << chunk);
+			chunks[chunk][offset] = m;
+			ids.emplace(m.get(), id);
+			count.store(id + 1, std::memory_order_release);
+			return id;
+		}
+
+		const material* operator[](uint32_t id) const {
+			const auto [chunk, offset] = locate(id);
+			return chunks[chunk][offset].get();
+		}
+		size_t size() const { return count.load(std::memory_order_acquire); }
+
+	private:
+		static constexpr uint32_t first_chunk_size = 64;
+
+		// chunk k holds the ids from first_chunk_size * (2^k - 1)
+		static std::pair<uint32_t, uint32_t> locate(uint32_t id) {
+			const uint32_t j = id / first_chunk_size + 1;
+			const uint32_t chunk = 31 - __builtin_clz(j);
+			return { chunk, id - first_chunk_size * ((1u << chunk) - 1) };
+		}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered ) const {
-			vec3 scatter_direction = rec.normal + random_unit_vector();
-			scattered = ray(rec.p, scatter_direction);
+	private:
+		std::unique_ptr<shared_ptr<material>[]> chunks[32];
+		std::atomic<uint32_t> count{ 0 };
+		std::unordered_map<const material*, uint32_t> ids;
+		std::mutex mutex;
+};
+
+inline material_table scene_materials;
+
+
+class lambertian final : public material {
+	public:
+		lambertian(const color& a) : material(material_type::lambertian), albedo(a) {}
+
+		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& smp ) const {
+			// cosine weighted around the normal
+			auto s = smp.get_2d();
+			vec3 scatter_direction = onb(rec.normal).local(sample_cosine_hemisphere(s.x, s.y));
+			scattered = spawn_ray(rec, scatter_direction);
 			attenuation = albedo;
 			return true;
 		}
@@ -31,36 +117,37 @@ class lambertian : public material {
 };
 
 
-class metal : public material {
+class metal final : public material {
 	public:
-		metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+		metal(const color& a, real f) : material(material_type::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered ) const {
+		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& smp ) const {
 			vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-			scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+			auto s = smp.get_2d();
+			scattered = spawn_ray(rec, reflected + fuzz*sample_in_unit_sphere(s.x, s.y, smp.get_1d()));
 			attenuation = albedo;
 			return (dot(scattered.direction(), rec.normal) > 0);
 		}
 
 	public:
 		color albedo;
-		double fuzz;
+		real fuzz;
 };
 
 
-double schlick(double cosine, double ref_idx) {
+real schlick(real cosine, real ref_idx) {
     auto r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
-    return r0 + (1-r0)*pow((1 - cosine),5);
+    return r0 + (1-r0)*std::pow((1 - cosine),5);
 }
 
-class dielectric : public material {
+class dielectric final : public material {
 	public:
-		dielectric(double ri) : ref_idx(ri) {}
+		dielectric(real ri) : material(material_type::dielectric), ref_idx(ri) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered ) const {
+		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& smp ) const {
 			attenuation = color(1.0, 1.0, 1.0);
-			double etai_over_etat;
+			real etai_over_etat;
 			if (rec.front_face) {
 				etai_over_etat = 1.0 / ref_idx;
 			} else {
@@ -68,36 +155,34 @@ class dielectric : public material {
 			}
 
 			vec3 unit_direction = unit_vector(r_in.direction());
-			double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-			double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
-			double reflect_prob = schlick(cos_theta, etai_over_etat);
+			real cos_theta = std::min(dot(-unit_direction, rec.normal), real(1));
+			real sin_theta = sqrt(1 - cos_theta*cos_theta);
+			real reflect_prob = schlick(cos_theta, etai_over_etat);
 
 			// check if it reflects back inside (like looking from inside water
 			// to air at a steep angle, the surface acts like mirror)
-			if (etai_over_etat * sin_theta > 1.0 || random_double() < reflect_prob) {
+			smp.skip(2); // the direction dimensions are not used
+			if (etai_over_etat * sin_theta > 1.0 || smp.get_1d() < reflect_prob) {
 				vec3 reflected = reflect(unit_direction, rec.normal);
-				scattered = ray(rec.p, reflected);
+				scattered = spawn_ray(rec, reflected);
 				return true;
 			}
-			if (random_double() < reflect_prob) {
-
-			}
 
 			vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-			scattered = ray(rec.p, refracted);
+			scattered = spawn_ray(rec, refracted);
 			return true;
 		}
 
 	public:
-		double ref_idx;
+		real ref_idx;
 };
 
 
-class diffuse_light : public material  {
+class diffuse_light final : public material  {
     public:
-        diffuse_light(const color& e) : emit(e) {}
+        diffuse_light(const color& e) : material(material_type::diffuse_light), emit(e) {}
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& smp) const {
             return false;
         }
 
@@ -109,4 +194,39 @@ class diffuse_light : public material  {
         color emit;
 };
 
+
+// Call the material functions with a switch on the type. The calls to the built-in
+// materials are qualified so they are not virtual and can be inlined.
+inline bool material_scatter(const material* m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& smp) {
+	#ifndef MATERIAL_VIRTUAL
+	switch (m->type) {
+		case material_type::lambertian:
+			return static_cast<const lambertian*>(m)->lambertian::scatter(r_in, rec, attenuation, scattered, smp);
+		case material_type::metal:
+			return static_cast<const metal*>(m)->metal::scatter(r_in, rec, attenuation, scattered, smp);
+		case material_type::dielectric:
+			return static_cast<const dielectric*>(m)->dielectric::scatter(r_in, rec, attenuation, scattered, smp);
+		case material_type::diffuse_light:
+			return false;
+		case material_type::other:
+			break;
+	}
+	#endif
+	return m->scatter(r_in, rec, attenuation, scattered, smp);
+}
+
+inline color material_emitted(const material* m) {
+	#ifndef MATERIAL_VIRTUAL
+	switch (m->type) {
+		case material_type::diffuse_light:
+			return static_cast<const diffuse_light*>(m)->emit;
+		case material_type::other:
+			break;
+		default:
+			return color(0, 0, 0);
+	}
+	#endif
+	return m->emitted();
+}
+
 #endif
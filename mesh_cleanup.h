@@ -0,0 +1,191 @@
+#ifndef MESH_CLEANUP_H
+#define MESH_CLEANUP_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+// false to load meshes as they are in the file, set by the -r option of rtweekend
+// and rtweekend-convert
+inline bool mesh_cleanup_enabled = true;
+
+// vertices closer than this part of the mesh bounding box diagonal are welded
+constexpr double mesh_weld_tolerance = 1e-6;
+
+struct mesh_cleanup_stats {
+	size_t vertices_before = 0;
+	size_t vertices_after = 0;
+	size_t triangles_before = 0;
+	size_t triangles_after = 0;
+	size_t degenerate_triangles = 0;
+	size_t duplicate_triangles = 0;
+};
+
+// Clean up an indexed triangle mesh before a bvh is built over it:
+// - vertices closer than the tolerance are welded into an earlier one
+// - triangles that collapse to a line or a point are dropped, that are the ones
+//   with a repeated vertex and the ones thinner than the tolerance
+// - triangles with the same three vertices in the same winding order as an earlier
+//   one are dropped, they would be hit at the same distance anyway. With the
+//   opposite winding they are kept, they face the other way (two sided or back to
+//   back faces).
+// - vertices no triangle uses anymore are removed
+// The order of the remaining vertices and triangles is kept.
+inline mesh_cleanup_stats clean_mesh(std::vector<point3>& verts, std::vector<uint32_t>& indices, double relative_tolerance = mesh_weld_tolerance) {
+	mesh_cleanup_stats stats;
+	stats.vertices_before = verts.size();
+	stats.triangles_before = indices.size() / 3;
+
+	aabb box;
+	for (const auto& v : verts)
+		box = surrounding_box(box, v);
+	const double diagonal = verts.empty() ? 0 : (box.max() - box.min()).length();
+
+	// The vertices are put in a grid with cells twice as big as the tolerance. A vertex
+	// only has to be compared to the ones in its own cell and in the neighbouring cells
+	// on the side of the cell it is in, 8 cells in total. The cell coordinates get 21
+	// bits each, which bounds how small the tolerance can be.
+	constexpr int64_t cell_bits = 21;
+	const double tolerance = std::max(relative_tolerance * diagonal, diagonal / ((int64_t(1) << cell_bits) - 4));
+	const double tolerance2 = tolerance * tolerance;
+	const double cell_size = 2 * tolerance;
+
+	auto cell_key = [](const int64_t c[3]) {
+		return (uint64_t)c[0] << (2 * cell_bits) | (uint64_t)c[1] << cell_bits | (uint64_t)c[2];
+	};
+
+	// Hash table from a cell to the last welded vertex put in it, with open addressing
+	// since it is looked up 8 times per vertex. The other welded vertices of a cell are
+	// linked through next.
+	size_t table_size = 16;
+	while (table_size < 2 * verts.size())
+		table_size *= 2;
+	const uint64_t empty_key = UINT64_MAX;
+	std::vector<uint64_t> table_keys(table_size, empty_key);
+	std::vector<uint32_t> table_last(table_size);
+	auto slot_of = [&](uint64_t key) {
+		size_t slot = (key * 0x9E3779B97F4A7C15ull) >> 32 & (table_size - 1);
+		while (table_keys[slot] != key && table_keys[slot] != empty_key)
+			slot = (slot + 1) & (table_size - 1);
+		return slot;
+	};
+
+	std::vector<uint32_t> next(verts.size(), UINT32_MAX);
+	std::vector<uint32_t> weld(verts.size());
+
+	for (uint32_t i = 0; i < verts.size(); i++) {
+		const auto& p = verts[i];
+		int64_t cell[3], side[3];
+		for (int k = 0; k < 3; k++) {
+			const double x = cell_size > 0 ? (p[k] - box.min()[k]) / cell_size : 0;
+			cell[k] = (int64_t)x + 1;
+			side[k] = x - std::floor(x) < 0.5 ? -1 : 1;
+		}
+
+		weld[i] = i;
+		for (int n = 0; n < 8 && weld[i] == i; n++) {
+			const int64_t c[3] = { cell[0] + (n & 1) * side[0], cell[1] + (n >> 1 & 1) * side[1], cell[2] + (n >> 2) * side[2] };
+			const auto slot = slot_of(cell_key(c));
+			for (auto j = table_keys[slot] == empty_key ? UINT32_MAX : table_last[slot]; j != UINT32_MAX; j = next[j]) {
+				if ((double)(verts[j] - p).squared_length() <= tolerance2) {
+					weld[i] = j;
+					break;
+				}
+			}
+		}
+
+		if (weld[i] == i) {
+			const auto key = cell_key(cell);
+			const auto slot = slot_of(key);
+			if (table_keys[slot] == key)
+				next[i] = table_last[slot];
+			table_keys[slot] = key;
+			table_last[slot] = i;
+		}
+	}
+
+	// drop the degenerate triangles
+	std::vector<uint32_t> kept;
+	kept.reserve(indices.size());
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		const uint32_t a = weld[indices[t]], b = weld[indices[t + 1]], c = weld[indices[t + 2]];
+		if (a == b || b == c || a == c) {
+			stats.degenerate_triangles++;
+			continue;
+		}
+
+		// twice the area over the longest edge is the smallest height of the triangle
+		const vec3 ab = verts[b] - verts[a], bc = verts[c] - verts[b], ca = verts[a] - verts[c];
+		const double longest = std::sqrt((double)std::max({ ab.squared_length(), bc.squared_length(), ca.squared_length() }));
+		if ((double)cross(ab, -ca).length() <= tolerance * longest) {
+			stats.degenerate_triangles++;
+			continue;
+		}
+		kept.insert(kept.end(), { a, b, c });
+	}
+
+	// sort the triangles on their vertices to find the duplicates, the first one of
+	// equal triangles is kept. The vertices are rotated to start at the smallest
+	// index, that keeps the winding order.
+	const size_t kept_count = kept.size() / 3;
+	std::vector<std::array<uint32_t, 4>> sorted(kept_count);
+	for (uint32_t t = 0; t < kept_count; t++) {
+		sorted[t] = { kept[3*t], kept[3*t + 1], kept[3*t + 2], t };
+		std::rotate(sorted[t].begin(), std::min_element(sorted[t].begin(), sorted[t].begin() + 3), sorted[t].begin() + 3);
+	}
+	std::sort(sorted.begin(), sorted.end());
+
+	std::vector<bool> duplicate(kept_count, false);
+	for (size_t i = 1; i < sorted.size(); i++) {
+		if (std::equal(sorted[i].begin(), sorted[i].begin() + 3, sorted[i - 1].begin())) {
+			duplicate[sorted[i][3]] = true;
+			stats.duplicate_triangles++;
+		}
+	}
+
+	// compact the vertices, only the ones still used remain
+	std::vector<bool> used(verts.size(), false);
+	for (size_t t = 0; t < kept_count; t++) {
+		if (!duplicate[t]) {
+			for (int k = 0; k < 3; k++)
+				used[kept[3*t + k]] = true;
+		}
+	}
+	std::vector<uint32_t> remap(verts.size(), UINT32_MAX);
+	uint32_t vertex_count = 0;
+	for (uint32_t i = 0; i < verts.size(); i++) {
+		if (used[i]) {
+			remap[i] = vertex_count;
+			verts[vertex_count++] = verts[i];
+		}
+	}
+	verts.resize(vertex_count);
+	verts.shrink_to_fit();
+
+	indices.clear();
+	for (size_t t = 0; t < kept_count; t++) {
+		if (!duplicate[t]) {
+			for (int k = 0; k < 3; k++)
+				indices.push_back(remap[kept[3*t + k]]);
+		}
+	}
+	indices.shrink_to_fit();
+
+	stats.vertices_after = verts.size();
+	stats.triangles_after = indices.size() / 3;
+	return stats;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const mesh_cleanup_stats& s) {
+	return out << "vertices " << s.vertices_before << " -> " << s.vertices_after
+		<< ", triangles " << s.triangles_before << " -> " << s.triangles_after
+		<< " (" << s.degenerate_triangles << " degenerate, " << s.duplicate_triangles << " duplicate)";
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+// Binary mesh files, written by rtweekend-convert from obj files. The file is the
+// in memory layout of an indexed triangle mesh, so it is loaded with one mmap and
+// used in place by a triangle_mesh.
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rtweekend.h"
+#include "triangle_mesh.h"
+#include "mapped_file.h"
+#include "obj.h"
+#include "mesh_cleanup.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "mesh files are little endian"
+#endif
+
+// mesh file layout, every block starts on a multiple of mesh_file_alignment:
+// mesh_file_header
+// float[3] per vertex
+// uint32_t[3] per triangle, indices into the vertices
+// optional float[3] per vertex, the normals
+// optional float[2] per vertex, the texture coordinates
+
+constexpr char mesh_file_magic[4] = { 'R', 'T', 'M', 'S' };
+constexpr uint32_t mesh_file_version = 1;
+constexpr size_t mesh_file_alignment = 64;
+
+enum mesh_file_flags : uint32_t {
+	mesh_file_normals = 1,
+	mesh_file_uvs = 2
+};
+
+struct mesh_file_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t vertex_count;
+	uint32_t triangle_count;
+	uint32_t reserved;
+	float bmin[3];
+	float bmax[3];
+	// from the start of the file, 0 when the block is not there
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t normal_offset;
+	uint64_t uv_offset;
+};
+
+// Write the triangles of an obj file. Without normals and uvs the positions of the
+// obj file are the vertices, cleaned up by clean_mesh unless mesh_cleanup_enabled is
+// off. With them every distinct position/uv/normal combination of a corner becomes
+// a vertex, they are only written when all faces have them.
+inline bool write_mesh_file(const std::string& filename, const obj_data& obj, bool normals_and_uvs) {
+	bool has_normals = normals_and_uvs && !obj.normals.empty();
+	bool has_uvs = normals_and_uvs && !obj.texcoords.empty();
+	for (const auto& c : obj.corners) {
+		has_normals = has_normals && c.vn >= 0;
+		has_uvs = has_uvs && c.vt >= 0;
+	}
+
+	std::vector<float> vertices, normals, uvs;
+	std::vector<uint32_t> indices(obj.corners.size());
+	if (!has_normals && !has_uvs) {
+		std::vector<point3> positions = obj.positions;
+		for (size_t i = 0; i < obj.corners.size(); i++) {
+			indices[i] = obj.corners[i].v;
+			if (indices[i] >= positions.size()) {
+				std::cerr << "write_mesh_file: vertex index out of range\n";
+				return false;
+			}
+		}
+		if (mesh_cleanup_enabled)
+			std::cout << "mesh cleanup: " << clean_mesh(positions, indices) << "\n";
+		for (const auto& v : positions)
+			vertices.insert(vertices.end(), { (float)v.x(), (float)v.y(), (float)v.z() });
+	} else {
+		auto key = [](const obj_index& c) {
+			return ((uint64_t)(uint32_t)c.v << 40) ^ ((uint64_t)(uint32_t)c.vt << 20) ^ (uint64_t)(uint32_t)c.vn;
+		};
+		std::unordered_map<uint64_t, std::vector<std::pair<obj_index, uint32_t>>> welded;
+		uint32_t vertex_count = 0;
+		for (size_t i = 0; i < obj.corners.size(); i++) {
+			const auto& c = obj.corners[i];
+			// the parser only checks the relative (negative) indices
+			if ((uint32_t)c.v >= obj.positions.size() || (has_normals && (uint32_t)c.vn >= obj.normals.size())
+				|| (has_uvs && (uint32_t)c.vt >= obj.texcoords.size())) {
+				std::cerr << "write_mesh_file: vertex index out of range\n";
+				return false;
+			}
+			auto& bucket = welded[key(c)];
+			auto it = std::find_if(bucket.begin(), bucket.end(), [&](const auto& e) {
+				return e.first.v == c.v && e.first.vt == c.vt && e.first.vn == c.vn;
+			});
+			if (it != bucket.end()) {
+				indices[i] = it->second;
+				continue;
+			}
+
+			bucket.push_back({ c, vertex_count });
+			indices[i] = vertex_count++;
+			const auto& p = obj.positions[c.v];
+			vertices.insert(vertices.end(), { (float)p.x(), (float)p.y(), (float)p.z() });
+			if (has_normals) {
+				const auto& n = obj.normals[c.vn];
+				normals.insert(normals.end(), { (float)n.x(), (float)n.y(), (float)n.z() });
+			}
+			if (has_uvs) {
+				const auto& uv = obj.texcoords[c.vt];
+				uvs.insert(uvs.end(), { (float)uv[0], (float)uv[1] });
+			}
+		}
+	}
+
+	mesh_file_header header = {};
+	std::copy(mesh_file_magic, mesh_file_magic + 4, header.magic);
+	header.version = mesh_file_version;
+	header.flags = (has_normals ? (uint32_t)mesh_file_normals : 0) | (has_uvs ? (uint32_t)mesh_file_uvs : 0);
+	header.vertex_count = vertices.size() / 3;
+	header.triangle_count = indices.size() / 3;
+
+	aabb box;
+	for (size_t i = 0; i < vertices.size(); i += 3)
+		box = surrounding_box(box, point3(vertices[i], vertices[i + 1], vertices[i + 2]));
+	for (int k = 0; k < 3; k++) {
+		header.bmin[k] = box._min[k];
+		header.bmax[k] = box._max[k];
+	}
+
+	auto align = [](uint64_t offset) { return (offset + mesh_file_alignment - 1) / mesh_file_alignment * mesh_file_alignment; };
+	uint64_t offset = align(sizeof(header));
+	header.vertex_offset = offset;
+	offset = align(offset + vertices.size() * sizeof(float));
+	header.index_offset = offset;
+	offset = align(offset + indices.size() * sizeof(uint32_t));
+	if (has_normals) {
+		header.normal_offset = offset;
+		offset = align(offset + normals.size() * sizeof(float));
+	}
+	if (has_uvs)
+		header.uv_offset = offset;
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cerr << "write_mesh_file: could not open " << filename << "\n";
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.seekp(header.vertex_offset);
+	file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(float));
+	file.seekp(header.index_offset);
+	file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+	if (has_normals) {
+		file.seekp(header.normal_offset);
+		file.write(reinterpret_cast<const char*>(normals.data()), normals.size() * sizeof(float));
+	}
+	if (has_uvs) {
+		file.seekp(header.uv_offset);
+		file.write(reinterpret_cast<const char*>(uvs.data()), uvs.size() * sizeof(float));
+	}
+
+	return (bool)file;
+}
+
+// Load a mesh file. The mesh uses the mapped file in place and applies the transform
+// when it reads a vertex, only the double precision build copies and transforms the
+// vertices. The texture coordinates are not used.
+inline shared_ptr<triangle_mesh> read_mesh_file(const std::string& filename, double scale, point3 pos, shared_ptr<material> m) {
+	auto file = make_shared<mapped_file>();
+	if (!file->open(filename))
+		return nullptr;
+
+	mesh_file_header header;
+	if (file->size() < sizeof(header)) {
+		std::cerr << "read_mesh_file: " << filename << " is too small\n";
+		return nullptr;
+	}
+	std::copy(file->data(), file->data() + sizeof(header), reinterpret_cast<char*>(&header));
+
+	auto block_fits = [&](uint64_t offset, uint64_t bytes) {
+		return offset % mesh_file_alignment == 0 && offset + bytes <= file->size();
+	};
+	bool has_normals = header.flags & mesh_file_normals;
+	if (!std::equal(mesh_file_magic, mesh_file_magic + 4, header.magic)
+		|| header.version != mesh_file_version
+		|| !block_fits(header.vertex_offset, (uint64_t)header.vertex_count * 3 * sizeof(float))
+		|| !block_fits(header.index_offset, (uint64_t)header.triangle_count * 3 * sizeof(uint32_t))
+		|| (has_normals && !block_fits(header.normal_offset, (uint64_t)header.vertex_count * 3 * sizeof(float)))) {
+		std::cerr << "read_mesh_file: " << filename << " is not a valid mesh file\n";
+		return nullptr;
+	}
+
+	const auto vertex_data = reinterpret_cast<const float*>(file->data() + header.vertex_offset);
+	const auto index_data = reinterpret_cast<const uint32_t*>(file->data() + header.index_offset);
+	const auto normal_data = reinterpret_cast<const float*>(file->data() + header.normal_offset);
+	const size_t index_count = (size_t)header.triangle_count * 3;
+
+	if (std::any_of(index_data, index_data + index_count, [&](uint32_t i) { return i >= header.vertex_count; })) {
+		std::cerr << "read_mesh_file: vertex index out of range in " << filename << "\n";
+		return nullptr;
+	}
+
+	#ifndef DOUBLE_PRECISION
+	static_assert(sizeof(point3) == 3 * sizeof(float), "mesh file vertices are used as point3");
+	aabb box(point3(header.bmin[0], header.bmin[1], header.bmin[2]), point3(header.bmax[0], header.bmax[1], header.bmax[2]));
+	return make_shared<triangle_mesh>(
+		file,
+		array_view<point3>(reinterpret_cast<const point3*>(vertex_data), header.vertex_count),
+		array_view<uint32_t>(index_data, index_count),
+		has_normals ? array_view<vec3>(reinterpret_cast<const vec3*>(normal_data), header.vertex_count) : array_view<vec3>(),
+		box,
+		m,
+		real(scale),
+		pos);
+	#else
+	std::vector<point3> vertices(header.vertex_count);
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const auto v = vertex_data + 3*i;
+		vertices[i] = point3(v[0] * scale + pos.x(), v[1] * scale + pos.y(), v[2] * scale + pos.z());
+	}
+
+	std::vector<vec3> normals;
+	if (has_normals) {
+		normals.resize(header.vertex_count);
+		for (size_t i = 0; i < normals.size(); i++)
+			normals[i] = vec3(normal_data[3*i], normal_data[3*i + 1], normal_data[3*i + 2]);
+	}
+
+	return make_shared<triangle_mesh>(std::move(vertices), std::vector<uint32_t>(index_data, index_data + index_count), m, std::move(normals));
+	#endif
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+#include "mapped_file.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Index of a triangle corner into the position, texture coordinate and normal
+// arrays of an obj file, -1 when the face does not have it.
+struct obj_index {
+	int32_t v;
+	int32_t vt;
+	int32_t vn;
+};
+
+// The parsed contents of an obj file. Faces with more than three vertices are
+// split into a fan of triangles, corners holds three entries per triangle.
+struct obj_data {
+	std::vector<point3> positions;
+	std::vector<std::array<real, 2>> texcoords;
+	std::vector<vec3> normals;
+	std::vector<obj_index> corners;
+
+	size_t triangle_count() const { return corners.size() / 3; }
+};
+
+// Parser for the text of an obj file that scans the buffer in place, numbers are
+// read with std::from_chars. Handles v, vt, vn and f with all slash forms
+// (v, v/vt, v//vn, v/vt/vn) and negative (relative) indices, everything else (o, g,
+// s, usemtl, comments, ...) is skipped. Texture coordinates can have one to three
+// numbers, a missing v is 0 and w is ignored.
+//
+// A chunk of a file can be parsed on its own. Negative indices are then relative
+// to what was read in the chunk, the corner fields that hold such an index are kept
+// in relative so they can be fixed up when the chunks are merged.
+class obj_parser {
+	public:
+		obj_parser(const char* begin, const char* end, obj_data& obj, bool chunk = false)
+			: p(begin), end(end), obj(obj), chunk(chunk) {}
+
+		bool parse() {
+			while (p < end) {
+				skip_space();
+				if (p < end && *p != '\n' && !parse_line())
+					return false;
+				skip_line();
+			}
+			return true;
+		}
+
+	private:
+		bool parse_line() {
+			if (p[0] == 'v' && p + 1 < end && is_space(p[1])) {
+				p += 1;
+				point3 v;
+				if (!parse_reals(v.e, 3))
+					return error("bad vertex");
+				obj.positions.push_back(v);
+			} else if (p[0] == 'v' && p + 2 < end && p[1] == 'n' && is_space(p[2])) {
+				p += 2;
+				vec3 n;
+				if (!parse_reals(n.e, 3))
+					return error("bad normal");
+				obj.normals.push_back(n);
+			} else if (p[0] == 'v' && p + 2 < end && p[1] == 't' && is_space(p[2])) {
+				p += 2;
+				// u with an optional v and w, w is not used
+				std::array<real, 2> uv = { 0, 0 };
+				real w;
+				if (!parse_reals(uv.data(), 1) || !parse_optional_real(uv[1]) || !parse_optional_real(w))
+					return error("bad texture coordinate");
+				obj.texcoords.push_back(uv);
+			} else if (p[0] == 'f' && p + 1 < end && is_space(p[1])) {
+				p += 1;
+				return parse_face();
+			}
+			return true;
+		}
+
+		bool parse_face() {
+			face.clear();
+			face_relative.clear();
+			skip_space();
+			while (p < end && *p != '\n' && *p != '#') {
+				obj_index idx = { -1, -1, -1 };
+				uint8_t rel = 0;
+				if (!parse_index(idx.v, obj.positions.size(), rel, 1))
+					return error("bad face");
+				if (p < end && *p == '/') {
+					p++;
+					if (p < end && *p != '/' && !parse_index(idx.vt, obj.texcoords.size(), rel, 2))
+						return error("bad face");
+					if (p < end && *p == '/') {
+						p++;
+						if (!parse_index(idx.vn, obj.normals.size(), rel, 4))
+							return error("bad face");
+					}
+				}
+				face.push_back(idx);
+				face_relative.push_back(rel);
+				skip_space();
+			}
+
+			if (face.size() < 3)
+				return error("face with less than 3 vertices");
+
+			// triangulate as a fan around the first vertex
+			for (size_t i = 1; i + 1 < face.size(); i++) {
+				add_corner(0);
+				add_corner(i);
+				add_corner(i + 1);
+			}
+			return true;
+		}
+
+		void add_corner(size_t i) {
+			auto corner = (uint32_t)obj.corners.size();
+			obj.corners.push_back(face[i]);
+			for (int field = 0; field < 3; field++) {
+				if (face_relative[i] & (1 << field))
+					relative.push_back(3*corner + field);
+			}
+		}
+
+		// obj indices start at 1, negative ones count back from the last element read so
+		// far, in a chunk that can be an element of an earlier chunk
+		bool parse_index(int32_t& index, size_t count, uint8_t& rel, uint8_t rel_bit) {
+			int32_t i;
+			auto [next, ec] = std::from_chars(p, end, i);
+			if (ec != std::errc() || i == 0)
+				return false;
+			p = next;
+			if (i > 0) {
+				index = i - 1;
+				return true;
+			}
+			index = (int32_t)count + i;
+			if (chunk) {
+				rel |= rel_bit;
+				return true;
+			}
+			return index >= 0;
+		}
+
+		bool parse_reals(real* values, int n) {
+			for (int k = 0; k < n; k++) {
+				skip_space();
+				if (p < end && *p == '+') // from_chars does not accept a plus sign
+					p++;
+				auto [next, ec] = std::from_chars(p, end, values[k]);
+				if (ec != std::errc())
+					return false;
+				p = next;
+			}
+			return true;
+		}
+
+		// a number if the line has one more, value is left as it is otherwise
+		bool parse_optional_real(real& value) {
+			skip_space();
+			if (p == end || *p == '\n' || *p == '#')
+				return true;
+			return parse_reals(&value, 1);
+		}
+
+		static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+		void skip_space() {
+			while (p < end && is_space(*p))
+				p++;
+		}
+
+		void skip_line() {
+			while (p < end && *p != '\n')
+				p++;
+			if (p < end)
+				p++;
+			line++;
+		}
+
+		bool error(const char* what) {
+			error_message = what;
+			return false;
+		}
+
+	public:
+		// corner fields (3*corner + 0 for v, 1 for vt, 2 for vn) with an index relative
+		// to the start of the chunk
+		std::vector<uint32_t> relative;
+
+		const char* error_message = nullptr;
+		size_t line = 1; // the line the parser is on, counted from the start of the chunk
+
+	private:
+		const char* p;
+		const char* end;
+		obj_data& obj;
+		bool chunk;
+		std::vector<obj_index> face;
+		std::vector<uint8_t> face_relative;
+};
+
+// Check that every corner refers to a position, texture coordinate and normal of the
+// file. The parser can not check positive indices, they may refer to an element
+// that comes later in the file.
+inline bool obj_indices_valid(const obj_data& obj, const std::string& filename) {
+	const int64_t v_count = obj.positions.size(), vt_count = obj.texcoords.size(), vn_count = obj.normals.size();
+	bool valid = true;
+	#pragma omp parallel for reduction(&&:valid)
+	for (size_t i = 0; i < obj.corners.size(); i++) {
+		const auto& c = obj.corners[i];
+		valid = valid && c.v >= 0 && c.v < v_count
+			&& c.vt >= -1 && c.vt < vt_count
+			&& c.vn >= -1 && c.vn < vn_count;
+	}
+	if (!valid)
+		std::cerr << "obj_parser: face index out of range in " << filename << "\n";
+	return valid;
+}
+
+// Parse an obj file, it is memory mapped and parsed in place. Big files are split at
+// line boundaries into a chunk per thread, the chunks are parsed concurrently and
+// then appended in file order with their relative indices fixed up, so the result
+// is the same as a serial parse.
+inline bool parse_obj(const std::string& filename, obj_data& obj) {
+	mapped_file file;
+	if (!file.open(filename))
+		return false;
+
+	const char* begin = file.data();
+	const char* end = begin + file.size();
+
+	constexpr size_t min_chunk_size = 1 << 20;
+	int chunk_count = 1;
+	#ifdef _OPENMP
+	chunk_count = std::max<int>(1, std::min<size_t>(omp_get_max_threads(), file.size() / min_chunk_size));
+	#endif
+
+	std::vector<const char*> bounds(chunk_count + 1, end);
+	bounds[0] = begin;
+	for (int c = 1; c < chunk_count; c++) {
+		auto split = std::max(bounds[c - 1], begin + file.size() * c / chunk_count);
+		auto newline = std::find(split, end, '\n');
+		bounds[c] = newline == end ? end : newline + 1;
+	}
+
+	std::vector<obj_data> chunks(chunk_count);
+	std::vector<std::vector<uint32_t>> relative(chunk_count);
+	std::vector<const char*> errors(chunk_count, nullptr);
+	std::vector<size_t> error_lines(chunk_count, 0);
+
+	#pragma omp parallel for schedule(static, 1)
+	for (int c = 0; c < chunk_count; c++) {
+		obj_parser parser(bounds[c], bounds[c + 1], chunks[c], chunk_count > 1);
+		if (!parser.parse()) {
+			errors[c] = parser.error_message;
+			error_lines[c] = parser.line;
+		}
+		relative[c] = std::move(parser.relative);
+	}
+
+	for (int c = 0; c < chunk_count; c++) {
+		if (errors[c]) {
+			auto line = std::count(begin, bounds[c], '\n') + error_lines[c];
+			std::cerr << "obj_parser: " << errors[c] << " on line " << line << " of " << filename << "\n";
+			return false;
+		}
+	}
+
+	if (chunk_count == 1) {
+		obj = std::move(chunks[0]);
+		return obj_indices_valid(obj, filename);
+	}
+
+	// where each chunk starts in the merged arrays
+	std::vector<size_t> v_first(chunk_count + 1, 0), vt_first(chunk_count + 1, 0), vn_first(chunk_count + 1, 0), corner_first(chunk_count + 1, 0);
+	for (int c = 0; c < chunk_count; c++) {
+		v_first[c + 1] = v_first[c] + chunks[c].positions.size();
+		vt_first[c + 1] = vt_first[c] + chunks[c].texcoords.size();
+		vn_first[c + 1] = vn_first[c] + chunks[c].normals.size();
+		corner_first[c + 1] = corner_first[c] + chunks[c].corners.size();
+	}
+
+	obj.positions.resize(v_first[chunk_count]);
+	obj.texcoords.resize(vt_first[chunk_count]);
+	obj.normals.resize(vn_first[chunk_count]);
+	obj.corners.resize(corner_first[chunk_count]);
+
+	bool indices_ok = true;
+	#pragma omp parallel for schedule(static, 1) reduction(&&:indices_ok)
+	for (int c = 0; c < chunk_count; c++) {
+		auto& chunk = chunks[c];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), obj.positions.begin() + v_first[c]);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), obj.texcoords.begin() + vt_first[c]);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), obj.normals.begin() + vn_first[c]);
+
+		const size_t first[3] = { v_first[c], vt_first[c], vn_first[c] };
+		for (auto field : relative[c]) {
+			auto& idx = chunk.corners[field / 3];
+			auto& value = (field % 3 == 0) ? idx.v : (field % 3 == 1) ? idx.vt : idx.vn;
+			value += (int32_t)first[field % 3];
+			indices_ok = indices_ok && value >= 0;
+		}
+		std::copy(chunk.corners.begin(), chunk.corners.end(), obj.corners.begin() + corner_first[c]);
+	}
+
+	if (!indices_ok) {
+		std::cerr << "obj_parser: negative index before the first element in " << filename << "\n";
+		return false;
+	}
+	return obj_indices_valid(obj, filename);
+}
+
+#endif
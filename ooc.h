@@ -0,0 +1,470 @@
+#ifndef OOC_H
+#define OOC_H
+
+// Out of core triangle meshes.
+// The triangles are grouped into spatially coherent clusters, every cluster gets
+// its own small bvh and both are written to a page file. When rendering the page
+// file is memory mapped and only a top level bvh over the cluster bounding boxes
+// lives in memory. A cluster is paged in the first time a ray reaches it, when
+// the resident set would grow over the configured cap the least recently used
+// clusters are dropped from memory again.
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "triangle.h"
+#include "bvh.h"
+#include "mapped_file.h"
+
+// page file layout:
+// ooc_file_header
+// ooc_cluster_header[cluster_count]
+// per cluster, starting on a page boundary: ooc_node[node_count], ooc_triangle[triangle_count]
+
+constexpr char ooc_magic[4] = { 'R', 'T', 'P', 'G' };
+constexpr uint32_t ooc_version = 2;
+constexpr size_t ooc_page_size = 4096;
+constexpr size_t ooc_cluster_size = 2048; // max triangles per cluster
+constexpr size_t ooc_leaf_size = 4;       // max triangles per leaf of a cluster bvh
+
+struct ooc_file_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t cluster_count;
+	uint32_t triangle_count;
+	// transform the source file was loaded with and its size and modification time,
+	// used to see if the page file is stale
+	float scale;
+	float pos[3];
+	uint64_t source_size;
+	int64_t source_mtime;
+};
+
+struct ooc_cluster_header {
+	float bmin[3];
+	float bmax[3];
+	uint64_t offset; // from the start of the file
+	uint32_t triangle_count;
+	uint32_t node_count;
+};
+
+// Flattened bvh node, the left child of an interior node directly follows it.
+// count > 0:  leaf with the triangles [offset, offset + count)
+// count == 0: interior node with its right child at offset
+struct ooc_node {
+	float bmin[3];
+	float bmax[3];
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct ooc_triangle {
+	float v[9];
+
+	point3 vertex(int i) const { return point3(v[3*i], v[3*i + 1], v[3*i + 2]); }
+	float centroid(int axis) const { return (v[axis] + v[3 + axis] + v[6 + axis]) / 3; }
+};
+
+static_assert(sizeof(ooc_file_header) == 48, "unexpected padding in ooc_file_header");
+static_assert(sizeof(ooc_cluster_header) == 40, "unexpected padding in ooc_cluster_header");
+static_assert(sizeof(ooc_node) == 32, "unexpected padding in ooc_node");
+
+
+aabb ooc_bounds(const std::vector<ooc_triangle>& triangles, size_t start, size_t end) {
+	aabb box;
+	for (auto i = start; i < end; i++)
+		for (int k = 0; k < 3; k++)
+			box = surrounding_box(box, triangles[i].vertex(k));
+
+	// same as triangle::bounding_box, a flat box would never be intersected
+	for (int k = 0; k < 3; k++) {
+		if (box._max[k] - box._min[k] < kEpsilon)
+			box._max[k] = box._min[k] + kEpsilon;
+	}
+	return box;
+}
+
+// split the range in two halves along the longest axis of the centroid bounds
+size_t ooc_median_split(std::vector<ooc_triangle>& triangles, size_t start, size_t end) {
+	aabb centroids;
+	for (auto i = start; i < end; i++) {
+		const auto& tri = triangles[i];
+		centroids = surrounding_box(centroids, point3(tri.centroid(0), tri.centroid(1), tri.centroid(2)));
+	}
+
+	auto axis = centroids.max_axis_idx();
+	auto mid = start + (end - start) / 2;
+	std::nth_element(triangles.begin() + start, triangles.begin() + mid, triangles.begin() + end,
+		[axis](const ooc_triangle& a, const ooc_triangle& b) { return a.centroid(axis) < b.centroid(axis); });
+	return mid;
+}
+
+// build the bvh of one cluster, the triangles are reordered so the leaves reference
+// contiguous ranges. Offsets are relative to the first triangle of the cluster.
+uint32_t ooc_build_nodes(std::vector<ooc_node>& nodes, std::vector<ooc_triangle>& triangles, size_t first, size_t start, size_t end) {
+	auto idx = (uint32_t)nodes.size();
+	nodes.push_back(ooc_node());
+
+	auto box = ooc_bounds(triangles, start, end);
+	for (int k = 0; k < 3; k++) {
+		nodes[idx].bmin[k] = box._min[k];
+		nodes[idx].bmax[k] = box._max[k];
+	}
+
+	if (end - start <= ooc_leaf_size) {
+		nodes[idx].offset = start - first;
+		nodes[idx].count = end - start;
+		return idx;
+	}
+
+	auto mid = ooc_median_split(triangles, start, end);
+	ooc_build_nodes(nodes, triangles, first, start, mid);
+	auto right = ooc_build_nodes(nodes, triangles, first, mid, end);
+	nodes[idx].offset = right;
+	nodes[idx].count = 0;
+	return idx;
+}
+
+void ooc_make_clusters(std::vector<ooc_triangle>& triangles, size_t start, size_t end, std::vector<std::pair<size_t, size_t>>& clusters) {
+	if (end - start <= ooc_cluster_size) {
+		clusters.emplace_back(start, end);
+		return;
+	}
+	auto mid = ooc_median_split(triangles, start, end);
+	ooc_make_clusters(triangles, start, mid, clusters);
+	ooc_make_clusters(triangles, mid, end, clusters);
+}
+
+// size and modification time of the source file, 0 when it is not there
+inline void ooc_source_stamp(const std::string& source_filename, uint64_t& size, int64_t& mtime) {
+	std::error_code ec_size, ec_time;
+	size = std::filesystem::file_size(source_filename, ec_size);
+	auto time = std::filesystem::last_write_time(source_filename, ec_time);
+	if (ec_size)
+		size = 0;
+	mtime = ec_time ? 0 : (int64_t)time.time_since_epoch().count();
+}
+
+// Write the triangles to a page file, the triangles are reordered in the process.
+// The file is written next to filename and only renamed to it when it is complete,
+// so a failed write does not leave a partial page file that a later run would use.
+bool write_ooc_file(const std::string& filename, std::vector<ooc_triangle>& triangles, float scale, point3 pos, const std::string& source_filename) {
+	std::vector<std::pair<size_t, size_t>> ranges;
+	if (!triangles.empty())
+		ooc_make_clusters(triangles, 0, triangles.size(), ranges);
+
+	std::vector<ooc_cluster_header> clusters(ranges.size());
+	std::vector<std::vector<ooc_node>> cluster_nodes(ranges.size());
+	auto align = [](uint64_t offset) { return (offset + ooc_page_size - 1) / ooc_page_size * ooc_page_size; };
+
+	uint64_t offset = align(sizeof(ooc_file_header) + clusters.size() * sizeof(ooc_cluster_header));
+	for (size_t c = 0; c < ranges.size(); c++) {
+		auto start = ranges[c].first;
+		auto end = ranges[c].second;
+		ooc_build_nodes(cluster_nodes[c], triangles, start, start, end);
+
+		auto& cluster = clusters[c];
+		auto box = ooc_bounds(triangles, start, end);
+		for (int k = 0; k < 3; k++) {
+			cluster.bmin[k] = box._min[k];
+			cluster.bmax[k] = box._max[k];
+		}
+		cluster.offset = offset;
+		cluster.triangle_count = end - start;
+		cluster.node_count = cluster_nodes[c].size();
+		offset = align(offset + cluster.node_count * sizeof(ooc_node) + cluster.triangle_count * sizeof(ooc_triangle));
+	}
+
+	const auto temp_filename = filename + ".tmp";
+	std::ofstream file(temp_filename, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cerr << "write_ooc_file: could not open " << temp_filename << "\n";
+		return false;
+	}
+
+	ooc_file_header header;
+	std::copy(ooc_magic, ooc_magic + 4, header.magic);
+	header.version = ooc_version;
+	header.cluster_count = clusters.size();
+	header.triangle_count = triangles.size();
+	header.scale = scale;
+	for (int k = 0; k < 3; k++)
+		header.pos[k] = pos[k];
+	ooc_source_stamp(source_filename, header.source_size, header.source_mtime);
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(clusters.data()), clusters.size() * sizeof(ooc_cluster_header));
+	for (size_t c = 0; c < ranges.size(); c++) {
+		file.seekp(clusters[c].offset);
+		file.write(reinterpret_cast<const char*>(cluster_nodes[c].data()), cluster_nodes[c].size() * sizeof(ooc_node));
+		file.write(reinterpret_cast<const char*>(triangles.data() + ranges[c].first), clusters[c].triangle_count * sizeof(ooc_triangle));
+	}
+	file.close();
+
+	std::error_code ec;
+	if (file)
+		std::filesystem::rename(temp_filename, filename, ec);
+	if (!file || ec) {
+		std::cerr << "write_ooc_file: could not write " << filename << "\n";
+		std::filesystem::remove(temp_filename, ec);
+		return false;
+	}
+	return true;
+}
+
+// Check that a cluster of a mapped page file lies within the file and that its bvh
+// only refers to its own nodes and triangles, hit_cluster reads them without checks.
+// Children have to come after their parent, which rules out cycles, and the tree
+// has to fit the traversal stack of hit_cluster.
+bool ooc_cluster_valid(const char* data, size_t size, const ooc_cluster_header& cluster) {
+	const uint64_t bytes = uint64_t(cluster.node_count) * sizeof(ooc_node) + uint64_t(cluster.triangle_count) * sizeof(ooc_triangle);
+	if (cluster.node_count == 0 || cluster.offset % alignof(ooc_node) != 0
+		|| cluster.offset > size || bytes > size - cluster.offset)
+		return false;
+
+	const auto nodes = reinterpret_cast<const ooc_node*>(data + cluster.offset);
+	std::vector<uint8_t> depth(cluster.node_count, 0);
+	for (uint32_t i = 0; i < cluster.node_count; i++) {
+		const auto& node = nodes[i];
+		if (node.count > 0) {
+			if (uint64_t(node.offset) + node.count > cluster.triangle_count)
+				return false;
+			continue;
+		}
+		if (node.offset <= i + 1 || node.offset >= cluster.node_count || depth[i] >= 62)
+			return false;
+		depth[i + 1] = std::max<uint8_t>(depth[i + 1], depth[i] + 1);
+		depth[node.offset] = std::max<uint8_t>(depth[node.offset], depth[i] + 1);
+	}
+	return true;
+}
+
+// check if the page file exists and was written with the same transform from the
+// source file as it is now
+bool ooc_file_matches(const std::string& filename, float scale, point3 pos, const std::string& source_filename) {
+	std::ifstream file(filename, std::ios::binary);
+	ooc_file_header header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return false;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	ooc_source_stamp(source_filename, source_size, source_mtime);
+	return std::equal(ooc_magic, ooc_magic + 4, header.magic)
+		&& header.version == ooc_version
+		&& header.scale == scale
+		&& header.pos[0] == pos[0] && header.pos[1] == pos[1] && header.pos[2] == pos[2]
+		&& header.source_size == source_size && header.source_mtime == source_mtime;
+}
+
+
+class ooc_mesh;
+
+// the top level bvh only sees the clusters, the triangles stay in the page file
+class ooc_cluster : public hittable {
+	public:
+		ooc_cluster(const ooc_mesh* mesh, uint32_t index, aabb box) : mesh(mesh), index(index), box(box) {
+			centroid = (box.min() + box.max()) / 2;
+		}
+
+		bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+		aabb bounding_box() const { return box; }
+
+	public:
+		const ooc_mesh* mesh;
+		uint32_t index;
+		aabb box;
+};
+
+class ooc_mesh : public hittable {
+	public:
+		// resident_cap: max number of bytes of cluster data that is kept in memory
+		ooc_mesh(const std::string& filename, size_t resident_cap, shared_ptr<material> m)
+			: resident_cap(resident_cap), mat_id(scene_materials.add(m))
+		{
+			if (!file.open(filename))
+				return;
+
+			const auto& header = *reinterpret_cast<const ooc_file_header*>(file.data());
+			if (file.size() < sizeof(ooc_file_header)
+				|| !std::equal(ooc_magic, ooc_magic + 4, header.magic)
+				|| header.version != ooc_version
+				|| file.size() < sizeof(ooc_file_header) + uint64_t(header.cluster_count) * sizeof(ooc_cluster_header))
+			{
+				std::cerr << "ooc_mesh: " << filename << " is not a valid page file\n";
+				file.close();
+				return;
+			}
+
+			clusters = reinterpret_cast<const ooc_cluster_header*>(file.data() + sizeof(ooc_file_header));
+			for (uint32_t c = 0; c < header.cluster_count; c++) {
+				if (!ooc_cluster_valid(file.data(), file.size(), clusters[c])) {
+					std::cerr << "ooc_mesh: cluster " << c << " of " << filename << " is damaged, delete the page file to write it again\n";
+					clusters = nullptr;
+					file.close();
+					return;
+				}
+			}
+			cluster_count = header.cluster_count;
+			states = std::make_unique<cluster_state[]>(cluster_count);
+
+			hittable_list objects;
+			for (uint32_t c = 0; c < cluster_count; c++) {
+				const auto& cl = clusters[c];
+				aabb cluster_box(point3(cl.bmin[0], cl.bmin[1], cl.bmin[2]), point3(cl.bmax[0], cl.bmax[1], cl.bmax[2]));
+				objects.add(make_shared<ooc_cluster>(this, c, cluster_box));
+				box = surrounding_box(box, cluster_box);
+			}
+
+			num_triangles += header.triangle_count;
+			if (cluster_count > 0)
+				tree = make_unique<bvh_node>(std::move(objects));
+		}
+
+		ooc_mesh(const ooc_mesh&) = delete;
+		ooc_mesh& operator=(const ooc_mesh&) = delete;
+
+		bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+			return tree && tree->hit(r, t_min, t_max, rec);
+		}
+
+		aabb bounding_box() const { return box; }
+
+		bool hit_cluster(uint32_t c, const ray& r, real t_min, real t_max, hit_record& rec) const {
+			make_resident(c);
+
+			const auto& cluster = clusters[c];
+			const auto nodes = reinterpret_cast<const ooc_node*>(file.data() + cluster.offset);
+			const auto triangles = reinterpret_cast<const ooc_triangle*>(nodes + cluster.node_count);
+
+			uint32_t stack[64];
+			auto si = 0;
+			stack[si++] = 0;
+			bool hit_anything = false;
+			uint32_t closest = 0;
+			real closest_u = 0, closest_v = 0;
+
+			while (si > 0) {
+				const auto idx = stack[--si];
+				const auto& node = nodes[idx];
+
+				aabb node_box(point3(node.bmin[0], node.bmin[1], node.bmin[2]), point3(node.bmax[0], node.bmax[1], node.bmax[2]));
+				if (node_box.intersect(r, t_min, t_max) < 0.0f)
+					continue;
+
+				if (node.count > 0) {
+					for (auto i = node.offset; i < node.offset + node.count; i++) {
+						const auto& tri = triangles[i];
+						real t, u, v;
+						if (intersect_triangle(tri.vertex(0), tri.vertex(1), tri.vertex(2), r, t_min, t_max, t, u, v)) {
+							hit_anything = true;
+							closest = i;
+							closest_u = u;
+							closest_v = v;
+							t_max = t;
+						}
+					}
+					continue;
+				}
+
+				stack[si++] = node.offset;
+				stack[si++] = idx + 1;
+			}
+
+			// the hit record is only filled for the closest triangle
+			if (hit_anything) {
+				const auto& tri = triangles[closest];
+				set_triangle_hit_record(tri.vertex(0), tri.vertex(1), tri.vertex(2), mat_id, r, t_max, closest_u, closest_v, rec);
+			}
+			return hit_anything;
+		}
+
+	private:
+		struct cluster_state {
+			std::atomic<bool> resident{false};
+			std::atomic<uint32_t> last_used{0};
+		};
+
+		size_t cluster_bytes(uint32_t c) const {
+			return clusters[c].node_count * sizeof(ooc_node) + clusters[c].triangle_count * sizeof(ooc_triangle);
+		}
+
+		// Mark the cluster as used and page it in if it is not resident. Dropping a
+		// cluster only hints the OS, the mapping stays valid, so rays that are still
+		// traversing an evicted cluster just fault its pages in again.
+		void make_resident(uint32_t c) const {
+			auto& state = states[c];
+			auto now = clock.load(std::memory_order_relaxed);
+			if (state.last_used.load(std::memory_order_relaxed) != now)
+				state.last_used.store(now, std::memory_order_relaxed);
+
+			if (state.resident.load(std::memory_order_acquire))
+				return;
+
+			std::lock_guard<std::mutex> lock(residency_mutex);
+			if (state.resident.load(std::memory_order_relaxed))
+				return;
+
+			num_ooc_cluster_page_ins++;
+			auto bytes = cluster_bytes(c);
+			while (resident_bytes + bytes > resident_cap && evict_least_recently_used(c)) {}
+
+			file.will_need(clusters[c].offset, bytes);
+			resident_bytes += bytes;
+			state.resident.store(true, std::memory_order_release);
+
+			// every page-in starts a new period for the lru bookkeeping
+			clock++;
+		}
+
+		bool evict_least_recently_used(uint32_t keep) const {
+			bool found = false;
+			uint32_t lru = 0;
+			for (uint32_t c = 0; c < cluster_count; c++) {
+				if (c == keep || !states[c].resident.load(std::memory_order_relaxed))
+					continue;
+				if (!found || states[c].last_used.load(std::memory_order_relaxed) < states[lru].last_used.load(std::memory_order_relaxed)) {
+					lru = c;
+					found = true;
+				}
+			}
+
+			if (!found)
+				return false;
+
+			num_ooc_cluster_evictions++;
+			file.dont_need(clusters[lru].offset, cluster_bytes(lru));
+			resident_bytes -= cluster_bytes(lru);
+			states[lru].resident.store(false, std::memory_order_release);
+			return true;
+		}
+
+	public:
+		size_t resident_cap;
+		uint32_t mat_id;
+
+	private:
+		mapped_file file;
+		const ooc_cluster_header* clusters = nullptr;
+		uint32_t cluster_count = 0;
+		unique_ptr<bvh_node> tree;
+		aabb box;
+
+		std::unique_ptr<cluster_state[]> states;
+		mutable std::mutex residency_mutex;
+		mutable size_t resident_bytes = 0;
+		mutable std::atomic<uint32_t> clock{1};
+};
+
+bool ooc_cluster::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	return mesh->hit_cluster(index, r, t_min, t_max, rec);
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "vec3.h"
 
+#include <cstring>
+
 class ray {
     public:
         ray() {}
@@ -13,7 +15,7 @@ class ray {
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
 
-        point3 at(double t) const {
+        point3 at(real t) const {
             return orig + t*dir;
         }
 
@@ -22,4 +24,36 @@ class ray {
         vec3 dir;
 };
 
+// Offset a point on a surface along the geometric normal n, so a ray that starts
+// there does not hit the surface it starts on again. Away from the origin the point
+// is moved a fixed number of ulps per dimension, which scales with the rounding
+// error of the hit point. Close to the origin, where ulps get tiny, a small
+// absolute offset is used instead.
+// "A Fast and Robust Method for Avoiding Self-Intersection", Waechter and Binder,
+// Ray Tracing Gems (2019)
+inline point3 offset_ray_origin(const point3& p, const vec3& n) {
+#ifdef DOUBLE_PRECISION
+	using real_bits = int64_t;
+	constexpr real float_scale = 1.0 / (65536.0 * 536870912.0);
+#else
+	using real_bits = int32_t;
+	constexpr real float_scale = 1.0f / 65536.0f;
+#endif
+	constexpr real origin = 1.0f / 32.0f;
+	constexpr real int_scale = 256.0f;
+
+	point3 result;
+	for (int i = 0; i < 3; i++) {
+		real_bits offset = int_scale * n[i];
+		real_bits bits;
+		std::memcpy(&bits, &p.e[i], sizeof(bits));
+		bits += p[i] < 0 ? -offset : offset;
+
+		real moved;
+		std::memcpy(&moved, &bits, sizeof(moved));
+		result[i] = std::abs(p[i]) < origin ? p[i] + float_scale * n[i] : moved;
+	}
+	return result;
+}
+
 #endif
@@ -0,0 +1,49 @@
+// Converts obj files to binary mesh files (see mesh_file.h). load_obj uses
+// <file>.obj.mesh instead of <file>.obj when it is there and newer.
+//
+// usage: rtweekend-convert [-n] [-r] file.obj [output]
+//   -n  also write the normals and texture coordinates
+//   -r  write the mesh as it is in the file, without clean_mesh
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "obj.h"
+#include "mesh_file.h"
+
+int main(int argc, char** argv) {
+	bool normals_and_uvs = false;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (std::strcmp(argv[arg], "-n") == 0)
+			normals_and_uvs = true;
+		else if (std::strcmp(argv[arg], "-r") == 0)
+			mesh_cleanup_enabled = false;
+		else
+			break;
+	}
+	if (arg >= argc || argv[arg][0] == '-') {
+		std::cerr << "usage: " << argv[0] << " [-n] [-r] file.obj [output]\n";
+		return 1;
+	}
+
+	std::string input = argv[arg];
+	std::string output = arg + 1 < argc ? argv[arg + 1] : input + ".mesh";
+
+	using Time = std::chrono::high_resolution_clock;
+	using fsec = std::chrono::duration<float>;
+	auto time_start = Time::now();
+
+	obj_data obj;
+	if (!parse_obj(input, obj))
+		return 1;
+	if (!write_mesh_file(output, obj, normals_and_uvs))
+		return 1;
+
+	fsec fs = Time::now() - time_start;
+	std::cout << input << " -> " << output << ": " << obj.positions.size() << " positions, "
+		<< obj.triangle_count() << " triangles in " << fs.count() << " (sec)\n";
+	return 0;
+}
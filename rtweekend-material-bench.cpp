@@ -0,0 +1,111 @@
+// Compares the two ways ray_color can call a material: the switch on the type in
+// material_scatter and material_emitted, and the virtual functions that
+// MATERIAL_VIRTUAL goes back to. Both run on the same hits, once with the materials
+// in a random order (the branches and the indirect call are hard to predict) and
+// once sorted by material.
+//
+// usage: rtweekend-material-bench [count]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "rtweekend.h"
+#include "material.h"
+
+struct hit {
+	ray r;
+	hit_record rec;
+};
+
+struct bench_result {
+	double seconds;
+	double checksum; // about the same for both dispatches, they compute the same rays
+};
+
+template <typename F>
+static bench_result run(const std::vector<hit>& hits, size_t n, F scatter) {
+	using Time = std::chrono::high_resolution_clock;
+	using fsec = std::chrono::duration<double>;
+
+	independent_sampler smp;
+	double checksum = 0;
+	auto start = Time::now();
+	for (size_t i = 0; i < n; i++) {
+		const hit& h = hits[i % hits.size()];
+		smp.start_pixel_sample((uint32_t)i, 0);
+		smp.next_bounce();
+		color attenuation(0, 0, 0);
+		ray scattered(point3(0, 0, 0), vec3(0, 0, 0)); // lights leave it as it is
+		color emitted = scatter(scene_materials[h.rec.mat_id], h, attenuation, scattered, smp);
+		checksum += emitted.x() + attenuation.y() + scattered.direction().z();
+	}
+	fsec seconds = Time::now() - start;
+	return { seconds.count(), checksum };
+}
+
+int main(int argc, char** argv) {
+	const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 24;
+
+	#ifdef MATERIAL_VIRTUAL
+	std::printf("MATERIAL_VIRTUAL is defined, material_scatter is virtual as well\n");
+	#endif
+
+	// the materials of the balls scene
+	const shared_ptr<material> materials[] = {
+		make_shared<lambertian>(color(0.5, 0.5, 0.5)),
+		make_shared<lambertian>(color(0.4, 0.2, 0.1)),
+		make_shared<metal>(color(0.7, 0.6, 0.5), 0.0),
+		make_shared<metal>(color(0.8, 0.2, 0.2), 0.3),
+		make_shared<dielectric>(1.5),
+		make_shared<diffuse_light>(color(4, 4, 4)),
+	};
+	std::vector<uint32_t> ids;
+	for (const auto& m : materials)
+		ids.push_back(scene_materials.add(m));
+
+	// hits on a sphere around the origin, from random directions
+	seed_thread_rng(1, 1);
+	std::vector<hit> hits(1 << 16);
+	for (auto& h : hits) {
+		const vec3 n = random_unit_vector();
+		const point3 origin = 3 * random_unit_vector();
+		h.r = ray(origin, n - origin);
+		h.rec.p = n;
+		h.rec.t = 1;
+		h.rec.set_face_normal(h.r, n);
+		h.rec.mat_id = ids[random_int(0, (int)ids.size() - 1)];
+	}
+
+	auto switch_dispatch = [](const material* m, const hit& h, color& attenuation, ray& scattered, sampler& smp) {
+		color emitted = material_emitted(m);
+		material_scatter(m, h.r, h.rec, attenuation, scattered, smp);
+		return emitted;
+	};
+	auto virtual_dispatch = [](const material* m, const hit& h, color& attenuation, ray& scattered, sampler& smp) {
+		color emitted = m->emitted();
+		m->scatter(h.r, h.rec, attenuation, scattered, smp);
+		return emitted;
+	};
+
+	std::printf("%zu material calls, the times include the sampler\n\n", n);
+	for (int sorted = 0; sorted < 2; sorted++) {
+		if (sorted)
+			std::sort(hits.begin(), hits.end(), [](const hit& a, const hit& b) { return a.rec.mat_id < b.rec.mat_id; });
+		const char* order = sorted ? "sorted by material" : "random order";
+		// once before measuring, to warm up the caches
+		run(hits, hits.size(), switch_dispatch);
+		run(hits, hits.size(), virtual_dispatch);
+		auto s = run(hits, n, switch_dispatch);
+		auto v = run(hits, n, virtual_dispatch);
+		// the inlined calls may round differently (fused multiply adds)
+		const bool same = std::abs(s.checksum - v.checksum) <= 1e-6 * std::abs(s.checksum);
+		std::printf("%-20s switch  %6.2f ns   virtual %6.2f ns   %s\n", order,
+			1e9 * s.seconds / n, 1e9 * v.seconds / n, same ? "same rays" : "RAYS DIFFER");
+	}
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+// Compares the direction sampling of sampling.h with the routines in vec3.h it
+// replaced, for speed and for the moments of the distributions.
+//
+// usage: rtweekend-sampling-bench [count]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "rtweekend.h"
+#include "sampling.h"
+
+struct bench_result {
+	double seconds;
+	vec3 mean;
+	real mean_length;
+	real mean_z2;
+};
+
+// n directions from next_block, block at a time, it draws its own random numbers
+// from thread_rng
+template <typename F>
+static bench_result run(const char* name, size_t n, F next_block, size_t block) {
+	using Time = std::chrono::high_resolution_clock;
+	using fsec = std::chrono::duration<double>;
+
+	seed_thread_rng(1, 1);
+	alignas(32) vec3 d[simd_width];
+	double sum[3] = { 0, 0, 0 }, length_sum = 0, z2_sum = 0; // in double, float runs out of digits
+
+	auto start = Time::now();
+	for (size_t i = 0; i < n; i += block) {
+		next_block(d);
+		for (size_t k = 0; k < block; k++) {
+			for (int j = 0; j < 3; j++)
+				sum[j] += d[k][j];
+			length_sum += d[k].length();
+			z2_sum += d[k].z() * d[k].z();
+		}
+	}
+	fsec seconds = Time::now() - start;
+
+	bench_result r = { seconds.count(), vec3(sum[0] / n, sum[1] / n, sum[2] / n), real(length_sum / n), real(z2_sum / n) };
+	std::printf("%-34s %7.2f ns  mean (%6.3f %6.3f %6.3f)  |d| %.4f  z^2 %.4f\n", name, 1e9 * r.seconds / n,
+		r.mean.x(), r.mean.y(), r.mean.z(), r.mean_length, r.mean_z2);
+	return r;
+}
+
+int main(int argc, char** argv) {
+	const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 24;
+	std::printf("%zu directions, simd width %d, the times include drawing the random numbers\n", n, simd_width);
+	std::printf("expected: sphere |d| 1, z^2 1/3; ball |d| 0.75; cosine hemisphere mean z 2/3, z^2 1/2\n\n");
+
+	const vec3 normal = unit_vector(vec3(0.3, 0.4, 0.8));
+	const onb basis(normal);
+	auto rnd = [] { return real(random_double()); };
+
+	run("random_unit_vector (vec3.h)", n, [](vec3* d) { d[0] = random_unit_vector(); }, 1);
+	run("sample_unit_vector", n, [&](vec3* d) { real u = rnd(); d[0] = sample_unit_vector(u, rnd()); }, 1);
+	run("sample_unit_vectors (simd)", n, [&](vec3* d) {
+		alignas(32) real u[simd_width], v[simd_width], x[simd_width], y[simd_width], z[simd_width];
+		for (int k = 0; k < simd_width; k++) {
+			u[k] = rnd();
+			v[k] = rnd();
+		}
+		sample_unit_vectors(u, v, x, y, z);
+		for (int k = 0; k < simd_width; k++)
+			d[k] = vec3(x[k], y[k], z[k]);
+	}, simd_width);
+	std::printf("\n");
+
+	run("random_in_unit_sphere (vec3.h)", n, [](vec3* d) { d[0] = random_in_unit_sphere(); }, 1);
+	run("sample_in_unit_sphere", n, [&](vec3* d) { real u = rnd(), v = rnd(); d[0] = sample_in_unit_sphere(u, v, rnd()); }, 1);
+	std::printf("\n");
+
+	// the old lambertian direction is not normalized, it is for the spread and speed
+	run("normal + random_unit_vector", n, [&](vec3* d) { d[0] = unit_vector(normal + random_unit_vector()); }, 1);
+	run("cosine hemisphere in an onb", n, [&](vec3* d) { real u = rnd(); d[0] = basis.local(sample_cosine_hemisphere(u, rnd())); }, 1);
+	run("sample_cosine_hemisphere", n, [&](vec3* d) { real u = rnd(); d[0] = sample_cosine_hemisphere(u, rnd()); }, 1);
+	run("sample_cosine_hemispheres (simd)", n, [&](vec3* d) {
+		alignas(32) real u[simd_width], v[simd_width], x[simd_width], y[simd_width], z[simd_width];
+		for (int k = 0; k < simd_width; k++) {
+			u[k] = rnd();
+			v[k] = rnd();
+		}
+		sample_cosine_hemispheres(u, v, x, y, z);
+		for (int k = 0; k < simd_width; k++)
+			d[k] = vec3(x[k], y[k], z[k]);
+	}, simd_width);
+
+	return 0;
+}
@@ -4,26 +4,44 @@
 #include "hittable_list.h"
 #include "sphere.h"
 #include "triangle.h"
+#include "triangle_mesh.h"
 #include "camera.h"
 #include "material.h"
 #include "bvh.h"
+#include "ooc.h"
+#include "obj.h"
+#include "mesh_file.h"
+#include "mesh_cleanup.h"
+#include "sampler.h"
+#include "film.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h" // to be able to save png's
 #define CHANNEL_NUM 3 // 3 channels (rgb)
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <sstream>
 #include <chrono> // to time the raytracing
+#include <filesystem>
+#include <future>
+#include <limits>
 
 #include <SDL2/SDL.h> // so we can show the result as it improves
 SDL_Window* gWindow = NULL;
 SDL_Renderer* gRenderer = NULL;
 
 
-color ray_color(const ray& r, color& background, const hittable& world, int depth) {
+// comment out to follow every path until it misses, is absorbed or reaches max_depth
+#define RUSSIAN_ROULETTE
+// the bounces a path always makes before russian roulette can end it, set with -b
+int roulette_min_bounces = 3;
+
+// the random numbers of the path come from smp, it was started for the pixel sample,
+// throughput is the product of the attenuations of the path up to r
+color ray_color(const ray& r, color& background, const hittable& world, int depth, sampler& smp, color throughput = color(1, 1, 1)) {
 	//std::cout << "shooting ray ------------------------------------- \n";
 	hit_record rec;
 
@@ -32,7 +50,8 @@ color ray_color(const ray& r, color& background, const hittable& world, int dept
 		return color(0, 0, 0);
 	}
 
-	if (!world.hit(r, 0.001, infinity, rec)) {
+	// no minimum distance needed, scattered rays start at an offset from the surface
+	if (!world.hit(r, 0, infinity, rec)) {
 		#ifdef BVH_HEATMAP
 		return rec.num_bvh_node_intersects * vec3(1,1,1);
 		#endif
@@ -48,9 +67,11 @@ color ray_color(const ray& r, color& background, const hittable& world, int dept
 
 	ray scattered;
 	color attenuation;
-	color emitted = rec.mat_ptr->emitted();
+	const material* mat = scene_materials[rec.mat_id];
+	color emitted = material_emitted(mat);
 
-	if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+	smp.next_bounce();
+	if (!material_scatter(mat, r, rec, attenuation, scattered, smp))
 		return emitted;
 
 	#ifdef DEBUG
@@ -63,87 +84,202 @@ color ray_color(const ray& r, color& background, const hittable& world, int dept
 	//return 0.5 * (rec.normal + vec3(1,1,1));
 	#endif
 
-	return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
-}
+	// Russian roulette: past roulette_min_bounces a path goes on with a probability
+	// that follows its throughput, so dark paths end early. A path that goes on is
+	// weighted by 1/p, the expected color stays the same.
+	throughput = throughput * attenuation;
+	#ifdef RUSSIAN_ROULETTE
+	if ((int)smp.bounces() > roulette_min_bounces) {
+		const real p = std::min(real(1), std::max({ throughput.x(), throughput.y(), throughput.z() }));
+		if (smp.get_roulette() >= p)
+			return emitted;
+		attenuation /= p;
+		throughput /= p;
+	}
+	#endif
 
+	return emitted + attenuation * ray_color(scattered, background, world, depth - 1, smp, throughput);
+}
 
-hittable_list load_obj(std::string filename, double scale, point3 pos, shared_ptr<material> m) {
-	hittable_list triangles;
 
-	// load obj file
-    std::ifstream obj_file;
-	obj_file.open(filename);
+// read the vertices and the triangles of an obj file, 3 vertex indices per triangle
+// with mesh_cleanup_enabled the mesh is welded and degenerate and duplicate triangles
+// are dropped, see clean_mesh. What the cleanup did is printed, or returned in
+// cleanup for loads that run concurrently and print it later.
+bool read_obj(std::string filename, double scale, point3 pos, std::vector<point3>& verts, std::vector<uint32_t>& indices, mesh_cleanup_stats* cleanup = nullptr) {
+	obj_data obj;
+	if (!parse_obj(filename, obj)) {
+		std::cerr << "read_obj: could not read " << filename << "\n";
+		return false;
+	}
 
-	// load file into vectors
-	std::vector<point3> verts;
-	std::vector<std::vector<int>> faces;
-	std::string line;
+	verts.resize(obj.positions.size());
+	for (size_t i = 0; i < verts.size(); i++) {
+		const auto& v = obj.positions[i];
+		verts[i] = point3(
+			v.x() * scale + pos.x(),
+			v.y() * scale + pos.y(),
+			v.z() * scale + pos.z());
+	}
 
-	while (getline(obj_file, line)) {
-		std::string type;
-		std::istringstream in(line);
-		in >> type;
-		if (type == "v") {
-			double x, y, z;
-			in >> x >> y >> z;
-			point3 vertex(
-				x * scale + pos.x(),
-				y * scale + pos.y(), 
-				z * scale + pos.z());
-			verts.push_back(vertex);
-		} else if (type == "f") {
+	indices.resize(obj.corners.size());
+	for (size_t i = 0; i < indices.size(); i++) {
+		if ((size_t)obj.corners[i].v >= verts.size()) {
+			std::cerr << "read_obj: vertex index out of range in " << filename << "\n";
+			verts.clear();
+			indices.clear();
+			return false;
+		}
+		indices[i] = obj.corners[i].v;
+	}
 
-			char delimiter_space = ' ';
-			char delimiter_slash = '/';
-			std::string vert_idx_slash = "";
-			std::vector<int> face;
+	if (mesh_cleanup_enabled) {
+		auto stats = clean_mesh(verts, indices);
+		if (cleanup)
+			*cleanup = stats;
+		else
+			std::cout << "mesh cleanup " << filename << ": " << stats << "\n";
+	}
+	return true;
+}
 
-			// normal triangle face
-			for (int i = 0; i < 3; ++i) {
-				in >> vert_idx_slash;
+// true when the binary mesh file made by rtweekend-convert is there and up to date
+bool mesh_file_usable(const std::string& obj_filename, const std::string& mesh_filename) {
+	std::error_code ec_obj, ec_mesh;
+	auto obj_time = std::filesystem::last_write_time(obj_filename, ec_obj);
+	auto mesh_time = std::filesystem::last_write_time(mesh_filename, ec_mesh);
+	return !ec_mesh && (ec_obj || mesh_time >= obj_time);
+}
 
-				// get only the number before the first slash
-				std::string vertex_index = vert_idx_slash.substr(0, vert_idx_slash.find(delimiter_slash));
+// Load an obj file as triangle mesh. When rtweekend-convert made a <file>.mesh for it
+// that one is loaded instead, it is used without parsing.
+// with quantize the vertices are stored as 16 bit integers, see triangle_mesh::quantize
+// cleanup is passed on to read_obj
+shared_ptr<triangle_mesh> load_obj(std::string filename, double scale, point3 pos, shared_ptr<material> m, bool quantize = false, mesh_cleanup_stats* cleanup = nullptr) {
+	shared_ptr<triangle_mesh> mesh;
+
+	auto mesh_filename = filename + ".mesh";
+	if (mesh_file_usable(filename, mesh_filename))
+		mesh = read_mesh_file(mesh_filename, scale, pos, m);
+
+	if (!mesh) {
+		// the triangles index the shared vertex buffer of the mesh
+		std::vector<point3> verts;
+		std::vector<uint32_t> indices;
+		read_obj(filename, scale, pos, verts, indices, cleanup);
+		mesh = make_shared<triangle_mesh>(std::move(verts), std::move(indices), m);
+	}
+	num_triangles += mesh->triangle_count();
 
-				face.push_back(std::stoi(vertex_index) - 1);
+	if (quantize)
+		mesh->quantize();
+	return mesh;
+}
 
-				std::getline(in, vert_idx_slash, delimiter_space);
+// an obj file that is part of a scene, optionally with a low poly proxy of it
+struct scene_asset {
+	std::string filename;
+	double scale;
+	point3 pos;
+	shared_ptr<material> mat;
+	std::string proxy = ""; // empty without a proxy
+};
+
+// Load the assets concurrently as OpenMP tasks, every mesh gets its own bvh which is
+// built in the same task, so the bvh of one asset is built while the next ones are
+// still being parsed. The results are in the order of the assets. When each asset
+// was loaded and when its bvh was done is printed, counted from the start, and what
+// the mesh cleanup did. That is printed after all assets are in, the tasks would
+// mix up their lines.
+// With proxies the proxy of an asset is loaded instead of the asset when it has one.
+// An asset that can not be loaded falls back to its proxy.
+hittable_list load_assets(const std::vector<scene_asset>& assets, bool proxies = false) {
+	using Time = std::chrono::high_resolution_clock;
+	using fsec = std::chrono::duration<float>;
+	auto start = Time::now();
+
+	std::vector<shared_ptr<hittable>> loaded(assets.size());
+	std::vector<fsec> load_done(assets.size()), build_done(assets.size());
+	std::vector<mesh_cleanup_stats> cleanup(assets.size());
+
+	#pragma omp parallel
+	#pragma omp single
+	for (size_t i = 0; i < assets.size(); i++) {
+		#pragma omp task firstprivate(i) shared(assets, loaded, load_done, build_done, cleanup)
+		{
+			const auto& asset = assets[i];
+			const bool use_proxy = proxies && !asset.proxy.empty();
+			auto mesh = load_obj(use_proxy ? asset.proxy : asset.filename, asset.scale, asset.pos, asset.mat, false, &cleanup[i]);
+			if (mesh->triangle_count() == 0 && !use_proxy && !asset.proxy.empty()) {
+				std::cerr << "using the proxy " << asset.proxy << " for " << asset.filename << "\n";
+				mesh = load_obj(asset.proxy, asset.scale, asset.pos, asset.mat, false, &cleanup[i]);
 			}
+			load_done[i] = Time::now() - start;
+			if (mesh->triangle_count() > 0)
+				loaded[i] = make_shared<bvh_node>(hittable_list(std::move(mesh)));
+			build_done[i] = Time::now() - start;
+		}
+	}
 
-			faces.push_back(face);
-
-			// if their is a fourth vertex make a second triangle
-			in >> vert_idx_slash;
-			if (vert_idx_slash.size() > 1) {
+	hittable_list list;
+	for (size_t i = 0; i < assets.size(); i++) {
+		std::cout << "asset " << (proxies && !assets[i].proxy.empty() ? assets[i].proxy : assets[i].filename)
+			<< ": loaded at " << load_done[i].count() << ", bvh at " << build_done[i].count() << " (sec)\n";
+		if (cleanup[i].vertices_before > 0)
+			std::cout << "  mesh cleanup: " << cleanup[i] << "\n";
+		if (loaded[i])
+			list.add(std::move(loaded[i]));
+	}
+	return list;
+}
 
-				// get only the number before the first slash
-				std::string vertex_index = vert_idx_slash.substr(0, vert_idx_slash.find(delimiter_slash));
+// The world of a scene with assets that have proxies, others holds the rest of the
+// scene. With full_world the returned world is built from the proxies and the world
+// with the full meshes is built in the background, main swaps it in when it is done.
+// Without full_world the world is built from the full meshes right away.
+std::unique_ptr<hittable> stream_assets(const std::vector<scene_asset>& assets, const hittable_list& others, std::future<std::unique_ptr<hittable>>* full_world) {
+	auto build = [](std::vector<scene_asset> assets, hittable_list objects, bool proxies) {
+		objects.add(load_assets(assets, proxies));
+		return std::unique_ptr<hittable>(std::make_unique<bvh_node>(std::move(objects)));
+	};
+
+	if (!full_world)
+		return build(assets, others, false);
+
+	*full_world = std::async(std::launch::async, build, assets, others, false);
+	return build(assets, others, true);
+}
 
-				std::vector<int> face2;
-				face2.push_back(face[0]);
-				face2.push_back(face[2]);
-				face2.push_back(std::stoi(vertex_index) - 1);
-				faces.push_back(face2);
+// Load an obj file as out of core mesh, only resident_cap bytes of its triangle data
+// are kept in memory. The first time the obj file is converted to a page file next to
+// it, after that the obj file is not parsed again.
+shared_ptr<hittable> load_obj_out_of_core(std::string filename, double scale, point3 pos, shared_ptr<material> m, size_t resident_cap) {
+	auto page_filename = filename + ".pages";
+
+	if (!ooc_file_matches(page_filename, scale, pos, filename)) {
+		std::vector<point3> verts;
+		std::vector<uint32_t> indices;
+		read_obj(filename, scale, pos, verts, indices);
+
+		std::vector<ooc_triangle> triangles(indices.size() / 3);
+		for (size_t i = 0; i < triangles.size(); i++) {
+			for (int k = 0; k < 3; k++) {
+				const auto& v = verts[indices[3*i + k]];
+				std::copy(v.e, v.e + 3, triangles[i].v + 3*k);
 			}
 		}
-    }
 
-	obj_file.close();
-
-	// make a triangle for every face
-	for (auto &face : faces) {
-		point3 v0 = verts[face[0]];
-		point3 v1 = verts[face[1]];
-		point3 v2 = verts[face[2]];
-		triangles.add(make_shared<triangle>( v0, v1, v2, m ));
-		num_triangles += 1;
+		std::cout << "writing page file " << page_filename << "\n";
+		write_ooc_file(page_filename, triangles, scale, pos, filename);
 	}
 
-	return triangles;
+	return make_shared<ooc_mesh>(page_filename, resident_cap, m);
 }
 
 
-void create_scene_blocks(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height) {
+// the subdivided blocks have the plain blocks as proxy, pass full_world to render the
+// proxy while the subdivided ones load, see stream_assets
+void create_scene_blocks(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height, std::future<std::unique_ptr<hittable>>* full_world = nullptr) {
 	auto aspect_ratio = 9.0 / 16.0;
 	image_width = 270;
 	image_height = static_cast<size_t>(image_width / aspect_ratio);
@@ -152,10 +288,9 @@ void create_scene_blocks(std::unique_ptr<hittable>& pWorld, camera& cam, size_t&
     cam.lookfrom(point3(6.92, 4.96, 7.36));
     cam.lookat(point3(0,0,0));
 
-    hittable_list objects;
-    objects.add(load_obj("blocks.obj", 1, point3(0,0,0), make_shared<lambertian>(color(1, 1, 1))));
-
-    pWorld = std::make_unique<bvh_node>(objects);
+    pWorld = stream_assets({
+		{ "blocks_subdivided.obj", 1, point3(0,0,0), make_shared<lambertian>(color(1, 1, 1)), "blocks.obj" },
+	}, hittable_list(), full_world);
 }
 
 void create_scene_street(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height) {
@@ -184,7 +319,25 @@ void create_scene_street(std::unique_ptr<hittable>& pWorld, camera& cam, size_t&
 	// auto material_metal = make_shared<metal>(color(1, 1, 1), 0.2);
 	// objects.add(make_shared<sphere>( point3(0,0.5,2), 0.5, material_metal ));
 
-    pWorld = std::make_unique<bvh_node>(objects);
+    pWorld = std::make_unique<bvh_node>(std::move(objects));
+}
+
+// the street scene with the mesh kept out of core, its triangle data gets at most
+// 256 KB of memory so clusters are constantly paged in and out
+void create_scene_street_out_of_core(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height) {
+	auto aspect_ratio = 9.0 / 16.0;
+	image_width = 540;
+	image_height = static_cast<size_t>(image_width / aspect_ratio);
+
+	cam.aspect_ratio(aspect_ratio);
+    cam.lookfrom(point3(-0.631397, 2.43137, 9.73438));
+    cam.lookat(point3(0,2.43137,0));
+    cam.vfov(64);
+
+    hittable_list objects;
+    objects.add(load_obj_out_of_core("street.obj", 1, point3(0,0,0), make_shared<lambertian>(color(1, 1, 0.7)), 256 * 1024));
+
+    pWorld = std::make_unique<bvh_node>(std::move(objects));
 }
 
 void create_scene_room(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height) {
@@ -206,16 +359,18 @@ void create_scene_room(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& i
     auto mirror = make_shared<metal>(color(1, 1, 1), 0.0);
     auto green = make_shared<lambertian>(color(0.2, 1, 0.2));
     auto yellow_light = make_shared<diffuse_light>(color(1, 1, 0.5));
-    objects.add(load_obj("room_obj_files/room.obj", 1, point3(0,0,0), white));
-    objects.add(load_obj("room_obj_files/window_mirror_frame_lamp.obj", 1, point3(0,0,0), yellow));
-    objects.add(load_obj("room_obj_files/wardrobe_pot.obj", 1, point3(0,0,0), orange));
-    objects.add(load_obj("room_obj_files/plant.obj", 1, point3(0,0,0), green));
-    objects.add(load_obj("room_obj_files/mirror.obj", 1, point3(0,0,0), mirror));
-    objects.add(load_obj("room_obj_files/lamp_stand.obj", 1, point3(0,0,0), grey));
-    objects.add(load_obj("room_obj_files/lamp_light.obj", 1, point3(0,0,0), yellow_light));
-
-
-    pWorld = std::make_unique<bvh_node>(objects);
+    objects.add(load_assets({
+        { "room/room.obj", 1, point3(0,0,0), white },
+        { "room/window_mirror_frame_lamp.obj", 1, point3(0,0,0), yellow },
+        { "room/wardrobe_pot.obj", 1, point3(0,0,0), orange },
+        { "room/plant.obj", 1, point3(0,0,0), green },
+        { "room/mirror.obj", 1, point3(0,0,0), mirror },
+        { "room/lamp_stand.obj", 1, point3(0,0,0), grey },
+        { "room/lamp_light.obj", 1, point3(0,0,0), yellow_light },
+    }));
+
+
+    pWorld = std::make_unique<bvh_node>(std::move(objects));
 }
 
 
@@ -282,7 +437,7 @@ void create_scene_balls(std::unique_ptr<hittable>& pWorld, camera& cam, size_t&
     world.add(load_obj("bunny.obj", 13, point3(-3,-0.4,0), material5));
 
     //return std::make_unique<hittable_list>(world);
-    pWorld = std::make_unique<bvh_node>(world);
+    pWorld = std::make_unique<bvh_node>(std::move(world));
 }
 
 
@@ -297,9 +452,13 @@ void create_scene_bunny(std::unique_ptr<hittable>& pWorld, camera& cam, size_t&
 
 	hittable_list objects;
 
-	// load bunny
+	// load bunny and the ground and walls
 	auto material_bunny = make_shared<lambertian>(color(.4, .2, .8));
-	objects.add(load_obj("bunny.obj", 7, point3(-0.2,-0.3,0), material_bunny));
+	auto box_material = make_shared<lambertian>(color(1, 1, 1));
+	objects.add(load_assets({
+		{ "bunny.obj", 7, point3(-0.2,-0.3,0), material_bunny },
+		{ "box_one_face_open.obj", 1, point3(0,0,0), box_material },
+	}));
 
 	auto material_red = make_shared<metal>(color(.8, .2, .2), 0.5);
 	auto material_green = make_shared<metal>(color(.2, .8, .2), 0.05);
@@ -312,14 +471,12 @@ void create_scene_bunny(std::unique_ptr<hittable>& pWorld, camera& cam, size_t&
     // add light
     objects.add(make_shared<sphere>( point3(0,2,0), 0.3, make_shared<diffuse_light>(color(1, 1, 1)) ));
 
-	// load ground and walls
-	auto box_material = make_shared<lambertian>(color(1, 1, 1));
-	objects.add(load_obj("box_one_face_open.obj", 1, point3(0,0,0), box_material));
-
-    pWorld = std::make_unique<bvh_node>(objects);
+    pWorld = std::make_unique<bvh_node>(std::move(objects));
 }
 
-void create_scene_blob(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height) {
+// the blob has a low poly proxy, pass full_world to render the proxy while the full
+// blob loads, see stream_assets
+void create_scene_blob(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& image_width, size_t& image_height, std::future<std::unique_ptr<hittable>>* full_world = nullptr) {
 	auto aspect_ratio = 9.0 / 16.0;
 	image_width = 540;
 	image_height = static_cast<size_t>(image_width / aspect_ratio);
@@ -328,24 +485,72 @@ void create_scene_blob(std::unique_ptr<hittable>& pWorld, camera& cam, size_t& i
     cam.lookfrom(point3(3,3,3));
     cam.lookat(point3(0,0,0));
 
-	hittable_list objects;
-
-	// load blob
-	auto material_blob = make_shared<lambertian>(color(1, 1, 1));
-	objects.add(load_obj("distorted_blob.obj", 0.7, point3(0,0,0), material_blob));
-
+	hittable_list lights;
 	auto red_light = make_shared<diffuse_light>(color(2, .2, .2));
 	auto blue_light = make_shared<diffuse_light>(color(.2, .2, 2));
-	objects.add(make_shared<sphere>(point3(-150,0,0), 100, blue_light));
-	objects.add(make_shared<sphere>(point3(150,0,0), 100, red_light));
+	lights.add(make_shared<sphere>(point3(-150,0,0), 100, blue_light));
+	lights.add(make_shared<sphere>(point3(150,0,0), 100, red_light));
 
-    pWorld = std::make_unique<bvh_node>(objects);
+	// load blob
+	auto material_blob = make_shared<lambertian>(color(1, 1, 1));
+	pWorld = stream_assets({
+		{ "distorted_blob.obj", 0.7, point3(0,0,0), material_blob, "distorted_blob_low_poly.obj" },
+	}, lights, full_world);
 }
 
 
-int main() {
-	const int samples_per_pixel = 16*32;
-	const int max_depth = 10;
+// usage: rtweekend [-s samples] [-t seconds] [-e error] [-d depth] [-b bounces] [-r]
+//   -s  samples per pixel on average, 16*32 by default
+//   -t  time budget from the start of the program, a pass that would not finish
+//       within it is not started
+//   -e  error target, the render stops when the estimated mean error on screen
+//       (see film::error) is below it
+//   -d  max ray depth, 64 by default. Russian roulette ends paths long before, the
+//       cap only stops paths that go on and on, like between two mirrors
+//   -b  bounces a path always makes before russian roulette can end it, 3 by default
+//   -r  load the meshes as they are in the file, without clean_mesh
+// With -t or -e the number of samples is open unless -s is given as well, the
+// first budget that is reached ends the render.
+int main(int argc, char** argv) {
+	int samples_per_pixel = 16*32; // on average, adaptive sampling moves them between pixels
+	float time_budget = 0; // seconds, 0 for none
+	real error_target = 0; // 0 for none
+	bool samples_given = false;
+	int max_depth = 64;
+	for (int arg = 1; arg < argc; arg++) {
+		if (arg + 1 < argc && std::strcmp(argv[arg], "-s") == 0) {
+			samples_per_pixel = std::max(1, std::atoi(argv[++arg]));
+			samples_given = true;
+		}
+		else if (arg + 1 < argc && std::strcmp(argv[arg], "-t") == 0)
+			time_budget = std::atof(argv[++arg]);
+		else if (arg + 1 < argc && std::strcmp(argv[arg], "-e") == 0)
+			error_target = std::atof(argv[++arg]);
+		else if (arg + 1 < argc && std::strcmp(argv[arg], "-d") == 0)
+			max_depth = std::max(1, std::atoi(argv[++arg]));
+		else if (arg + 1 < argc && std::strcmp(argv[arg], "-b") == 0)
+			roulette_min_bounces = std::max(0, std::atoi(argv[++arg]));
+		else if (std::strcmp(argv[arg], "-r") == 0)
+			mesh_cleanup_enabled = false;
+		else {
+			std::cerr << "usage: " << argv[0] << " [-s samples] [-t seconds] [-e error] [-d depth] [-b bounces] [-r]\n";
+			return 1;
+		}
+	}
+	const bool open_samples = (time_budget > 0 || error_target > 0) && !samples_given;
+
+	#ifdef ADAPTIVE_SAMPLING
+	int max_samples_per_pixel = 4*samples_per_pixel;
+	const int adaptive_warmup = 32; // samples every pixel gets before its tile can stop
+	real adaptive_threshold = 0.01; // mean error on screen of a tile, 1/255 is one step of the png
+	if (error_target > 0)
+		adaptive_threshold = error_target;
+	#else
+	int max_samples_per_pixel = samples_per_pixel;
+	#endif
+	if (open_samples)
+		max_samples_per_pixel = std::numeric_limits<int>::max();
+	const sampler_type sampler_kind = sampler_type::sobol;
 
 	// default values
     color background(0,0,0);
@@ -358,54 +563,145 @@ int main() {
     	50,                               // vfov
     	(float)image_width / image_height // aspect_ratio
     );
+    using Time = std::chrono::high_resolution_clock; 
+    using fsec = std::chrono::duration<float>; 
+
+    auto program_start = Time::now();
+
+    // The scene is loaded on a thread of its own while SDL starts up on this one,
+    // SDL wants its video calls on the main thread. The window needs the image size
+    // of the scene so it is created after the scene is there.
     std::unique_ptr<hittable> pWorld;
-	create_scene_balls(pWorld, cam, image_width, image_height);
+    std::future<std::unique_ptr<hittable>> full_world; // scenes with proxies take &full_world
+    fsec setup_time(0);
+    auto scene_loaded = std::async(std::launch::async, [&] {
+    	auto setup_start = Time::now();
+    	create_scene_blocks(pWorld, cam, image_width, image_height, &full_world);
+    	setup_time = Time::now() - setup_start;
+    });
 
 	// SDL stuff
+    auto sdl_start = Time::now();
     SDL_Init(SDL_INIT_VIDEO); // initialize SDL
+    fsec sdl_time = Time::now() - sdl_start;
+
+    scene_loaded.get();
+
     gWindow = SDL_CreateWindow("rtweekend", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, image_width, image_height, SDL_WINDOW_SHOWN);
     gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_PRESENTVSYNC); // create renderer
     SDL_SetRenderDrawColor(gRenderer, 255, 255, 255, 255); // initialize renderer color
     SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_BLEND); // allow colors with alpha transparancy values
 	
     // start timer
-    using Time = std::chrono::high_resolution_clock; 
-    using fsec = std::chrono::duration<float>; 
     auto time_start = Time::now();
 
-    // initialize pixel hdr array to (0, 0, 0) vectors
-    vec3* pixels_hdr = new vec3[image_width * image_height];
-    for (size_t i = 0; i < image_width * image_height; i++) {
-		pixels_hdr[i] = color(0, 0, 0);
-	}
+    // the hdr sums of the pixels and what adaptive sampling needs
+    film pixels_hdr(image_width, image_height);
+    const size_t sample_budget = open_samples ? SIZE_MAX : (size_t)samples_per_pixel * image_width * image_height;
 	uint8_t* pixels_rgb = new uint8_t[image_width * image_height * CHANNEL_NUM]; // 3 channels (rgb)
 
 	// SDL preview texture
     SDL_Texture *preview_texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, image_width, image_height);
+
+    fsec first_preview_time(0);
+    fsec full_world_time(0);
     
-    for (int s = 0; s < samples_per_pixel; ++s) {
-    	std::cerr << "\rSample: " << s << ' ' << std::flush;
+    // Every pass takes a sample in the pixels of the active tiles, until the budget
+    // of samples_per_pixel on average is spent or every tile has converged, or the
+    // time budget or error target is reached. The time of the next pass is predicted
+    // from the time per sample of the last one.
+    size_t samples_taken = 0;
+    real image_error = infinity;
+    fsec last_pass_time(0);
+    size_t last_pass_samples = 0;
+    auto film_start = Time::now(); // when the film was last cleared
+    auto render_done = [&](int s) {
+    	if (s >= max_samples_per_pixel || samples_taken >= sample_budget || pixels_hdr.active_tiles == 0)
+    		return true;
+    	if (error_target > 0 && image_error <= error_target)
+    		return true;
+    	if (time_budget > 0 && samples_taken > 0 && last_pass_samples > 0) {
+    		fsec elapsed = Time::now() - program_start;
+    		float next_pass = last_pass_time.count() * pixels_hdr.active_pixels() / last_pass_samples;
+    		return elapsed.count() + next_pass > time_budget;
+    	}
+    	return false;
+    };
+
+    // With a time budget the world with the full meshes is only swapped in while there
+    // is at least as much time left as the film of the proxies took, otherwise the
+    // image of the proxies is kept. Waiting for it would overrun the budget.
+    auto restart_fits = [&] {
+    	if (time_budget <= 0)
+    		return true;
+    	fsec elapsed = Time::now() - program_start;
+    	fsec film_time = Time::now() - film_start;
+    	return time_budget - elapsed.count() >= film_time.count();
+    };
+
+    for (int s = 0; !render_done(s) || (full_world.valid() && time_budget <= 0); ++s) {
+    	// Swap in the world with the full meshes when its background build is done and
+    	// start accumulating again, until the budget is met again. The render threads
+    	// are joined between passes, so a pass sees one world only. When the render is
+    	// done without a time budget it waits for it.
+    	const bool full_world_ready = full_world.valid() && full_world.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    	if ((full_world_ready && restart_fits()) || (full_world.valid() && time_budget <= 0 && render_done(s))) {
+    		pWorld = full_world.get();
+    		full_world_time = Time::now() - program_start;
+    		std::cerr << "\rFull meshes after " << s << " samples\n";
+    		pixels_hdr.clear();
+    		samples_taken = 0;
+    		image_error = infinity;
+    		film_start = Time::now();
+    		s = 0;
+    	}
+
+    	std::cerr << "\rSample: " << s << ", active tiles: " << pixels_hdr.active_tiles << ' ' << std::flush;
+
+    	auto pass_start = Time::now();
+
+    	// OpenMP, every thread has its own sampler
+    	#ifndef DEBUG
+    	#pragma omp parallel
+    	#endif
+    	{
+    	auto smp = make_sampler(sampler_kind, samples_per_pixel, image_width);
 
-    	// OpenMP
     	#ifndef DEBUG
-    	#pragma omp parallel for schedule(dynamic, 1)
+    	#pragma omp for schedule(dynamic, 1)
     	#endif
 		for (int j = (int)image_height-1; j >= 0; --j) {
 			for (size_t i = 0; i < image_width; ++i) {
+				if (!pixels_hdr.active(i, image_height - 1 - j))
+					continue;
 				num_primary_rays++;
-				auto u = (i + random_double()) / (image_width-1);
-				auto v = (j + random_double()) / (image_height-1);
+				int idx = (image_height - 1 - j) * image_width + i;
+				smp->start_pixel_sample(idx, pixels_hdr.samples[idx]);
+
+				auto jitter = smp->get_2d();
+				auto u = (i + jitter.x) / (image_width-1);
+				auto v = (j + jitter.y) / (image_height-1);
 				ray r = cam.get_ray(u, v);
 
-				int idx = (image_height - 1 - j) * image_width + i;
-				pixels_hdr[idx] += ray_color(r, background, *pWorld, max_depth);
+				pixels_hdr.add(idx, ray_color(r, background, *pWorld, max_depth, *smp));
 			}
 		}
+    	}
+		last_pass_time = Time::now() - pass_start;
+		last_pass_samples = pixels_hdr.total_samples() - samples_taken;
+		samples_taken += last_pass_samples;
+
+		#ifdef ADAPTIVE_SAMPLING
+		if (s + 1 >= adaptive_warmup)
+			pixels_hdr.update_tiles(adaptive_threshold);
+		#endif
+		if (error_target > 0)
+			image_error = pixels_hdr.mean_error();
 
 		#ifdef BVH_HEATMAP
 		float max = 0;
 		for (size_t i = 0; i < image_width * image_height; i++) {
-			color* p = pixels_hdr + i;
+			color* p = &pixels_hdr.sum[i];
 			if (p->r() > max)
 				max = p->r();
 		}
@@ -413,7 +709,7 @@ int main() {
 		std::cout << "max number bvh node hits: " << max << "\n";
 
 		for (size_t i = 0; i < image_width * image_height; i++) {
-			color* p = pixels_hdr + i;
+			color* p = &pixels_hdr.sum[i];
 			*p = inferno(p->x() / max);
 			//p = vec3(1,1,1) - p / max; // black and white
 		}
@@ -433,7 +729,7 @@ int main() {
 		// convert pixels from hdr to rgb
 		for (size_t i = 0; i < image_width * image_height; i++) {
 			uint8_t* pixel = pixels_rgb + (i * CHANNEL_NUM);
-			rgb_from_hdr(pixel, pixels_hdr[i], s + 1);
+			rgb_from_hdr(pixel, pixels_hdr.sum[i], std::max(pixels_hdr.samples[i], 1u));
 
 			// edit the preview texture with the new color values
 			Uint8 *base = ((uint8_t*)pixels) + (4 * i);
@@ -446,6 +742,9 @@ int main() {
 		SDL_UnlockTexture(preview_texture); // unlock texture
 		SDL_RenderCopy(gRenderer, preview_texture, NULL, NULL); // copy the preview_texture to the rendering context
 		SDL_RenderPresent(gRenderer); // draw the screen
+
+		if (first_preview_time.count() == 0)
+			first_preview_time = Time::now() - program_start;
 	}
 
 
@@ -462,12 +761,21 @@ int main() {
 		image_width * CHANNEL_NUM
 	);
 
+    if (full_world.valid())
+    	std::cerr << "\rThe time budget ran out before the full meshes were in, the image is of the proxies\n";
+    const float average_samples = (float)samples_taken / (image_width * image_height);
+    const uint32_t most_samples = *std::max_element(pixels_hdr.samples.begin(), pixels_hdr.samples.end());
+    image_error = pixels_hdr.mean_error();
     if (img_saved)
-    	std::cerr << "\rImage saved with " << samples_per_pixel << " samples per pixel\n";
+    	std::cerr << "\rImage saved with " << average_samples << " samples per pixel on average, estimated error " << image_error << "\n";
     else
     	std::cerr << "\rError while saving image\n";
 
     std::cout << "Info:\n";
+    std::cout << "Scene setup time                            :" << setup_time.count() << " (sec)\n";
+    std::cout << "SDL init time (during scene setup)          :" << sdl_time.count() << " (sec)\n";
+    std::cout << "Time to first preview                       :" << first_preview_time.count() << " (sec)\n";
+    std::cout << "Time to full meshes (0 without proxies)     :" << full_world_time.count() << " (sec)\n";
     std::cout << "Render time                                 :" << fs.count() << " (sec)\n";
     std::cout << "Total number of triangles                   :" << num_triangles << "\n";
     std::cout << "Total number of primary rays                :" << num_primary_rays << "\n";
@@ -479,8 +787,16 @@ int main() {
     std::cout << "Total number of BVH ray-leaf intersections  :" << num_ray_bvh_leaf_intersections << "\n";
     std::cout << "Total number of BVH nodes                   :" << num_bvh_nodes << "\n";
     std::cout << "Total number of BVH leaf nodes              :" << num_bvh_leaf_nodes << "\n";
-    std::cout << "Samples per pixel                           :" << samples_per_pixel << "\n";
+    std::cout << "Total number of out of core cluster page-ins:" << num_ooc_cluster_page_ins << "\n";
+    std::cout << "Total number of out of core evictions       :" << num_ooc_cluster_evictions << "\n";
+    std::cout << "Out of core cluster page-ins per primary ray:" << (float)num_ooc_cluster_page_ins / num_primary_rays << "\n";
+    std::cout << "Time budget, error target (0 for none)      :" << time_budget << " (sec), " << error_target << "\n";
+    std::cout << "Samples per pixel (average, most)           :" << average_samples << ", " << most_samples << "\n";
+    std::cout << "Estimated mean error on screen              :" << image_error << "\n";
+    std::cout << "Converged tiles                             :" << pixels_hdr.tiles_x * pixels_hdr.tiles_y - pixels_hdr.active_tiles << " of " << pixels_hdr.tiles_x * pixels_hdr.tiles_y << "\n";
+    std::cout << "Sampler                                     :" << sampler_name(sampler_kind) << "\n";
     std::cout << "Maxium ray depth                            :" << max_depth << "\n";
+    std::cout << "Bounces before russian roulette             :" << roulette_min_bounces << "\n";
     std::cout << "Image Dimensions                            :" << image_width << "x" << image_height << "\n";
 
 
@@ -506,9 +822,13 @@ int main() {
 		
 	}
 
-	delete [] pixels_hdr;
 	delete [] pixels_rgb;
 
+	auto teardown_start = Time::now();
+	pWorld.reset();
+	fsec teardown_time = Time::now() - teardown_start;
+	std::cout << "Scene teardown time                         :" << teardown_time.count() << " (sec)\n";
+
     // destroy window
     SDL_DestroyRenderer(gRenderer);
 
@@ -2,6 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -16,6 +17,15 @@
 #endif
 
 
+// Scalar type of the geometry and intersection code. Everything is single precision,
+// define DOUBLE_PRECISION for a validation build that does the same work in double.
+//#define DOUBLE_PRECISION
+#ifdef DOUBLE_PRECISION
+using real = double;
+#else
+using real = float;
+#endif
+
 // Usings
 
 using std::shared_ptr;
@@ -26,9 +36,9 @@ using std::sqrt;
 
 // Constants
 
-const float infinity = std::numeric_limits<float>::infinity();
+const real infinity = std::numeric_limits<real>::infinity();
 const double pi = 3.1415926535897932385;
-constexpr double kEpsilon = 1e-5; 
+constexpr real kEpsilon = 1e-5; 
 
 // Utility Functions
 
@@ -36,14 +46,62 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180;
 }
 
+// PCG32 random number generator (pcg-random.org). Small and fast, its state is
+// 16 bytes so every thread has its own, see thread_rng.
+class pcg32 {
+	public:
+		constexpr pcg32() {}
+		pcg32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+		// initseq selects one of 2^63 independent streams
+		void seed(uint64_t initstate, uint64_t initseq) {
+			state = 0;
+			inc = (initseq << 1) | 1;
+			next_uint();
+			state += initstate;
+			next_uint();
+		}
+
+		uint32_t next_uint() {
+			uint64_t oldstate = state;
+			state = oldstate * 6364136223846793005ull + inc;
+			uint32_t xorshifted = (uint32_t)(((oldstate >> 18) ^ oldstate) >> 27);
+			uint32_t rot = (uint32_t)(oldstate >> 59);
+			return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+		}
+
+		// in [0,1)
+		double next_double() {
+			return next_uint() * 0x1p-32;
+		}
+
+	private:
+		uint64_t state = 0x853c49e6748fea9bull;
+		uint64_t inc = 0xda3e39cb94b95bdbull;
+};
+
+// The generator random_double() and friends use, one per thread so there is no lock
+// like the one in rand(). The render loop seeds it for every pixel and sample, the
+// image does not depend on which thread renders which pixel.
+inline thread_local pcg32 thread_rng;
+
+inline void seed_thread_rng(uint64_t pixel, uint64_t sample) {
+	// scramble the pixel index (splitmix64) so neighbouring pixels do not start on
+	// nearby states, every sample uses its own stream
+	uint64_t z = pixel + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	thread_rng.seed(z ^ (z >> 31), sample);
+}
+
 inline double random_int(int min, int max) {
 	// Returns a random int in [min,max].
-	return rand()%(max-min + 1) + min;
+	return (int)(thread_rng.next_uint() % (uint32_t)(max-min + 1)) + min;
 }
 
 inline double random_double() {
 	// Returns a random real in [0,1).
-	return rand() / (RAND_MAX + 1.0);
+	return thread_rng.next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -73,5 +131,7 @@ std::atomic<uint32_t> num_bvh_nodes(0);
 std::atomic<uint32_t> num_bvh_leaf_nodes(0); 
 std::atomic<uint32_t> num_ray_bvh_leaf_tests(0);
 std::atomic<uint32_t> num_ray_bvh_leaf_intersections(0);
+std::atomic<uint32_t> num_ooc_cluster_page_ins(0);
+std::atomic<uint32_t> num_ooc_cluster_evictions(0);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,355 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+#include "rtweekend.h"
+#include "blue_noise.h"
+
+// The random numbers of a path come from a sampler. A path asks for its numbers in a
+// fixed layout of dimensions, so a dimension is always used for the same thing,
+// whatever the path hits:
+//   0, 1   the position in the pixel
+// and for every bounce dims_per_bounce dimensions from 2 + bounce * dims_per_bounce:
+//   +0, +1 the direction the material scatters to
+//   +2     a choice the material makes (reflect or refract) or the fuzz radius
+//   +3     russian roulette
+// Unused dimensions of a bounce are skipped.
+//
+// A sampler is used by one thread, it is started for every sample of a pixel.
+
+enum class sampler_type : uint8_t { independent, stratified, sobol, halton, blue_noise };
+
+struct sample2d {
+	real x, y;
+};
+
+class sampler {
+	public:
+		static constexpr uint32_t dims_per_bounce = 4;
+		static constexpr uint32_t first_bounce_dimension = 2;
+
+		virtual ~sampler() = default;
+
+		void start_pixel_sample(uint32_t pixel, uint32_t index) {
+			this->pixel = pixel;
+			this->index = index;
+			dimension = 0;
+			bounce = 0;
+			start();
+		}
+
+		// move on to the dimensions of the next bounce
+		void next_bounce() {
+			dimension = first_bounce_dimension + bounce++ * dims_per_bounce;
+		}
+
+		real get_1d() {
+			return sample_1d(dimension++);
+		}
+
+		sample2d get_2d() {
+			auto s = sample_2d(dimension);
+			dimension += 2;
+			return s;
+		}
+
+		void skip(uint32_t dims) {
+			dimension += dims;
+		}
+
+		// the russian roulette number of the current bounce, whatever the material used
+		real get_roulette() {
+			return sample_1d(first_bounce_dimension + (bounce - 1) * dims_per_bounce + 3);
+		}
+
+		// the number of bounces of the path so far, the first hit is bounce 1
+		uint32_t bounces() const {
+			return bounce;
+		}
+
+	protected:
+		virtual void start() {}
+		virtual real sample_1d(uint32_t dim) = 0;
+		virtual sample2d sample_2d(uint32_t dim) { return { sample_1d(dim), sample_1d(dim + 1) }; }
+
+	protected:
+		uint32_t pixel = 0;
+		uint32_t index = 0;
+		uint32_t dimension = 0;
+		uint32_t bounce = 0;
+};
+
+
+// 32 bit hash to seed the scrambling of a pixel and dimension
+inline uint32_t hash_bits(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+inline uint32_t hash_bits(uint32_t a, uint32_t b) {
+	return hash_bits(a ^ hash_bits(b + 0x9e3779b9u));
+}
+
+inline uint32_t hash_bits(uint32_t a, uint32_t b, uint32_t c) {
+	return hash_bits(hash_bits(a, b), c);
+}
+
+// the top 24 bits as a number in [0,1), exact in float so it stays below 1
+inline real bits_to_unit(uint32_t x) {
+	return real(x >> 8) * real(0x1p-24);
+}
+
+// a random permutation of [0, n) picked by p, i is mapped to its place in it
+// (Kensler, Correlated Multi-Jittered Sampling)
+inline uint32_t permute_index(uint32_t i, uint32_t n, uint32_t p) {
+	uint32_t w = n - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do {
+		i ^= p;
+		i *= 0xe170893d;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8;
+		i *= 0x0929eb3f;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | p >> 27;
+		i *= 0x6935fa69;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3df;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= n);
+	return (i + p) % n;
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+
+// Uniform random numbers, every pixel sample reseeds thread_rng, see seed_thread_rng.
+class independent_sampler : public sampler {
+	protected:
+		void start() override { seed_thread_rng(pixel, index); }
+		real sample_1d(uint32_t) override { return random_double(); }
+};
+
+
+// Jittered stratification per dimension (pair) over the samples of a pixel. A 1d
+// dimension has a stratum per sample, a 2d one a grid of about that many cells. The
+// strata are visited in a different random order per pixel and dimension, samples
+// past the number of strata are independent.
+class stratified_sampler : public sampler {
+	public:
+		stratified_sampler(uint32_t samples_per_pixel)
+			: samples(std::max(samples_per_pixel, 1u)),
+			  nx((uint32_t)std::ceil(std::sqrt((double)samples))),
+			  ny((samples + nx - 1) / nx) {}
+
+	protected:
+		real sample_1d(uint32_t dim) override {
+			const auto seed = hash_bits(pixel, dim);
+			const real jitter = bits_to_unit(hash_bits(seed, index));
+			if (index >= samples)
+				return jitter;
+			return (permute_index(index, samples, seed) + jitter) / samples;
+		}
+
+		sample2d sample_2d(uint32_t dim) override {
+			const auto seed = hash_bits(pixel, dim);
+			const real jx = bits_to_unit(hash_bits(seed, index, 1));
+			const real jy = bits_to_unit(hash_bits(seed, index, 2));
+			if (index >= nx * ny)
+				return { jx, jy };
+			const auto cell = permute_index(index, nx * ny, seed);
+			return { (cell % nx + jx) / nx, (cell / nx + jy) / ny };
+		}
+
+	private:
+		uint32_t samples;
+		uint32_t nx, ny;
+};
+
+
+// Owen scrambled Sobol points (Burley, Practical Hash-based Owen Scrambling). Every
+// pair of dimensions uses the first two Sobol dimensions, with the sample index
+// shuffled and the points scrambled differently per pixel and pair, so the pairs
+// are not correlated and each one is well stratified in 2d.
+class sobol_sampler : public sampler {
+	protected:
+		real sample_1d(uint32_t dim) override {
+			const auto seed = hash_bits(pixel, dim);
+			const auto i = nested_uniform_scramble(index, hash_bits(seed, 0));
+			return bits_to_unit(nested_uniform_scramble(reverse_bits(i), hash_bits(seed, 1)));
+		}
+
+		sample2d sample_2d(uint32_t dim) override {
+			const auto seed = hash_bits(pixel, dim);
+			const auto i = nested_uniform_scramble(index, hash_bits(seed, 0));
+			return {
+				bits_to_unit(nested_uniform_scramble(reverse_bits(i), hash_bits(seed, 1))),
+				bits_to_unit(nested_uniform_scramble(sobol_1(i), hash_bits(seed, 2)))
+			};
+		}
+
+	private:
+		// the second Sobol dimension, the first one is reverse_bits
+		static uint32_t sobol_1(uint32_t i) {
+			uint32_t result = 0;
+			for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+				if (i & 1)
+					result ^= v;
+			}
+			return result;
+		}
+
+		static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+			x += seed;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return x;
+		}
+
+		static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+			return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+		}
+};
+
+
+// The Halton sequence with a prime base per dimension, Owen scrambled per pixel: every
+// digit is shifted by a hash of the digits before it. Past the primes in the table
+// the bases are used again with another scramble.
+class halton_sampler : public sampler {
+	protected:
+		real sample_1d(uint32_t dim) override {
+			static constexpr uint32_t primes[] = {
+				2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+				59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+				137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223 };
+			constexpr uint32_t prime_count = sizeof(primes) / sizeof(primes[0]);
+
+			const uint32_t base = primes[dim % prime_count];
+			const double inv_base = 1.0 / base;
+			uint32_t digits_hash = hash_bits(pixel, dim);
+			uint32_t i = index;
+			double factor = inv_base, result = 0;
+			// the digits past the last one of the index are zero, they are scrambled
+			// too until they no longer change a float
+			while (factor > 0x1p-24) {
+				const uint32_t digit = i % base;
+				i /= base;
+				result += ((digit + hash_bits(digits_hash) % base) % base) * factor;
+				digits_hash = hash_bits(digits_hash, digit);
+				factor *= inv_base;
+			}
+			return std::min(real(result), real(0x1.fffffep-1));
+		}
+};
+
+
+// For previews at a few samples per pixel. The samples of a pixel are the points of
+// a rank-1 lattice (the R2 sequence of Roberts, for 1d the golden ratio one),
+// shifted by values from a blue noise mask (a Cranley-Patterson rotation). The error
+// of neighbouring pixels then follows the mask and looks like blue noise instead of
+// white noise. Every dimension (pair) reads the mask at its own offset and visits
+// the lattice points in its own order, so the dimensions are not correlated.
+// The lattice points are permuted among the first samples_per_pixel.
+class blue_noise_sampler : public sampler {
+	public:
+		blue_noise_sampler(uint32_t samples_per_pixel, uint32_t image_width)
+			: samples(std::max(samples_per_pixel, 1u)), width(std::max(image_width, 1u)), mask(blue_noise_mask::get()) {}
+
+	protected:
+		real sample_1d(uint32_t dim) override {
+			constexpr double alpha = 0.6180339887498949; // 1 / golden ratio
+			const auto i = shuffle(dim);
+			return wrap(offset(dim, 0) + i * alpha);
+		}
+
+		sample2d sample_2d(uint32_t dim) override {
+			constexpr double alpha0 = 0.7548776662466927; // 1 / plastic number
+			constexpr double alpha1 = 0.5698402909980532; // 1 / plastic number^2
+			const auto i = shuffle(dim);
+			return { wrap(offset(dim, 0) + i * alpha0), wrap(offset(dim, 1) + i * alpha1) };
+		}
+
+	private:
+		uint32_t shuffle(uint32_t dim) const {
+			if (index >= samples)
+				return index;
+			// the same points for every pixel, in another order per dimension
+			return permute_index(index, samples, hash_bits(dim, 0x626e));
+		}
+
+		real offset(uint32_t dim, uint32_t k) const {
+			const auto shift = hash_bits(dim, k);
+			const int x = pixel % width + (shift & 0xffff);
+			const int y = pixel / width + (shift >> 16);
+			return mask(x, y);
+		}
+
+		static real wrap(double x) {
+			return std::min(real(x - std::floor(x)), real(0x1.fffffep-1));
+		}
+
+	private:
+		uint32_t samples;
+		uint32_t width;
+		const blue_noise_mask& mask;
+};
+
+
+// image_width is only used by the blue noise sampler, to find the place of a pixel
+// in the mask
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, uint32_t samples_per_pixel, uint32_t image_width = 0) {
+	switch (type) {
+		case sampler_type::blue_noise:
+			return std::make_unique<blue_noise_sampler>(samples_per_pixel, image_width);
+		case sampler_type::stratified:
+			return std::make_unique<stratified_sampler>(samples_per_pixel);
+		case sampler_type::sobol:
+			return std::make_unique<sobol_sampler>();
+		case sampler_type::halton:
+			return std::make_unique<halton_sampler>();
+		case sampler_type::independent:
+			break;
+	}
+	return std::make_unique<independent_sampler>();
+}
+
+inline const char* sampler_name(sampler_type type) {
+	switch (type) {
+		case sampler_type::independent: return "independent";
+		case sampler_type::stratified: return "stratified";
+		case sampler_type::sobol: return "sobol";
+		case sampler_type::halton: return "halton";
+		case sampler_type::blue_noise: return "blue noise";
+	}
+	return "?";
+}
+
+#endif
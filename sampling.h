@@ -0,0 +1,130 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+// Mappings from uniform numbers in [0,1) (see sampler.h) to directions. They have no
+// loops or branches and do not call sin and cos: the angles are kept within
+// [-pi/4, pi/4] by the concentric mapping, where a short polynomial is accurate to
+// float precision. Every mapping also has a version for simd_width numbers at once.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "rtweekend.h"
+#include "simd.h"
+
+// sin and cos for |t| <= pi/4, Taylor polynomials, the error is below 4e-7
+template <typename T>
+inline void sincos_quarter_pi(T t, T& s, T& c) {
+	const T t2 = t*t;
+	s = t * (T(1) + t2*(T(-1.0/6) + t2*(T(1.0/120) + t2*T(-1.0/5040))));
+	c = T(1) + t2*(T(-0.5) + t2*(T(1.0/24) + t2*(T(-1.0/720) + t2*T(1.0/40320))));
+}
+
+// Shirley and Chiu's concentric mapping of the square to the unit disk, it keeps
+// strata of the square together, unlike the polar mapping.
+inline void sample_concentric_disk(real u, real v, real& x, real& y) {
+	const real a = 2*u - 1;
+	const real b = 2*v - 1;
+	const bool a_major = std::abs(a) > std::abs(b);
+	const real r = a_major ? a : b;
+	// the angle is pi/4 * b/a or pi/2 - pi/4 * a/b, 0 in the center
+	const real ratio = r == 0 ? 0 : (a_major ? b : a) / r;
+	real s, c;
+	sincos_quarter_pi(real(pi/4) * ratio, s, c);
+	x = r * (a_major ? c : s);
+	y = r * (a_major ? s : c);
+}
+
+// Uniform on the sphere: the area of the disk inside radius r maps to the cap with
+// z above 1 - 2r^2 (an equal area mapping)
+inline vec3 sample_unit_vector(real u, real v) {
+	real x, y;
+	sample_concentric_disk(u, v, x, y);
+	const real r2 = x*x + y*y;
+	const real scale = 2 * std::sqrt(std::max(real(0), 1 - r2));
+	return vec3(x * scale, y * scale, 1 - 2*r2);
+}
+
+// cube root of w in [0,1]: a guess from the bits of the float (dividing the exponent
+// by 3) and three Newton steps, accurate to float precision and faster than cbrt
+inline real cbrt_unit(real w) {
+	float x = float(w);
+	uint32_t i;
+	std::memcpy(&i, &x, sizeof(i));
+	i = i / 3 + 709921077;
+	std::memcpy(&x, &i, sizeof(x));
+	for (int k = 0; k < 3; k++)
+		x -= (x*x*x - float(w)) / (3*x*x);
+	return x;
+}
+
+// uniform in the unit ball, the radius has density 3r^2
+inline vec3 sample_in_unit_sphere(real u, real v, real w) {
+	return cbrt_unit(w) * sample_unit_vector(u, v);
+}
+
+// Cosine weighted on the hemisphere around z (Malley's method: lift the disk)
+inline vec3 sample_cosine_hemisphere(real u, real v) {
+	real x, y;
+	sample_concentric_disk(u, v, x, y);
+	return vec3(x, y, std::sqrt(std::max(real(0), 1 - x*x - y*y)));
+}
+
+
+// Orthonormal basis around a unit vector w, without branches (Duff et al., Building
+// an Orthonormal Basis, Revisited).
+class onb {
+	public:
+		onb(const vec3& n) : w(n) {
+			const real sign = std::copysign(real(1), n.z());
+			const real a = -1 / (sign + n.z());
+			const real b = n.x() * n.y() * a;
+			u = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+			v = vec3(b, sign + n.y() * n.y() * a, -n.y());
+		}
+
+		// a vector given in the basis, in world space
+		vec3 local(const vec3& a) const {
+			return a.x()*u + a.y()*v + a.z()*w;
+		}
+
+	public:
+		vec3 u, v, w;
+};
+
+
+// The same mappings for simd_width numbers at once. The arrays hold simd_width
+// numbers and are aligned to 32 bytes, like the blocks in triangle_block.h.
+
+inline void sample_concentric_disk(vfloat u, vfloat v, vfloat& x, vfloat& y) {
+	const vfloat a = vfloat(2)*u - vfloat(1);
+	const vfloat b = vfloat(2)*v - vfloat(1);
+	const vfloat a_major = vabs(a) > vabs(b);
+	const vfloat r = select(a_major, a, b);
+	const vfloat ratio = select(r == vfloat(0), vfloat(0), select(a_major, b, a) / r);
+	vfloat s, c;
+	sincos_quarter_pi(vfloat(real(pi/4)) * ratio, s, c);
+	x = r * select(a_major, c, s);
+	y = r * select(a_major, s, c);
+}
+
+inline void sample_unit_vectors(const real* u, const real* v, real* x, real* y, real* z) {
+	vfloat dx, dy;
+	sample_concentric_disk(vfloat::load(u), vfloat::load(v), dx, dy);
+	const vfloat r2 = dx*dx + dy*dy;
+	const vfloat scale = vfloat(2) * vsqrt(vmax(vfloat(0), vfloat(1) - r2));
+	(dx * scale).store(x);
+	(dy * scale).store(y);
+	(vfloat(1) - vfloat(2)*r2).store(z);
+}
+
+inline void sample_cosine_hemispheres(const real* u, const real* v, real* x, real* y, real* z) {
+	vfloat dx, dy;
+	sample_concentric_disk(vfloat::load(u), vfloat::load(v), dx, dy);
+	dx.store(x);
+	dy.store(y);
+	vsqrt(vmax(vfloat(0), vfloat(1) - dx*dx - dy*dy)).store(z);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// A small wrapper around SSE and AVX, so the kernels that test a ray against a
+// block of primitives are written once for every width. With AVX enabled
+// (-mavx or -march=native on a cpu that has it) a block holds 8 primitives,
+// otherwise 4. Without SSE, or in the double precision build, the same code
+// runs on plain arrays.
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "rtweekend.h"
+
+#if defined(__AVX__) && !defined(DOUBLE_PRECISION)
+#include <immintrin.h>
+#define SIMD_AVX
+constexpr int simd_width = 8;
+#elif defined(__SSE2__) && !defined(DOUBLE_PRECISION)
+#include <emmintrin.h>
+#define SIMD_SSE
+constexpr int simd_width = 4;
+#else
+#define SIMD_SCALAR
+constexpr int simd_width = 4;
+#endif
+
+#ifdef SIMD_AVX
+struct vfloat {
+	__m256 v;
+
+	vfloat() {}
+	vfloat(__m256 v) : v(v) {}
+	vfloat(float f) : v(_mm256_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm256_load_ps(p); }
+	void store(float* p) const { _mm256_store_ps(p, v); }
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat operator<(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vfloat operator<=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vfloat operator>(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vfloat operator==(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+inline vfloat operator&(vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b) { return _mm256_or_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline int movemask(vfloat mask) { return _mm256_movemask_ps(mask.v); }
+
+inline float reduce_min(vfloat a) {
+	__m128 m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+	m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+	return _mm_cvtss_f32(m);
+}
+#endif
+
+#ifdef SIMD_SSE
+struct vfloat {
+	__m128 v;
+
+	vfloat() {}
+	vfloat(__m128 v) : v(v) {}
+	vfloat(float f) : v(_mm_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm_load_ps(p); }
+	void store(float* p) const { _mm_store_ps(p, v); }
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat operator<(vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vfloat operator<=(vfloat a, vfloat b) { return _mm_cmple_ps(a.v, b.v); }
+inline vfloat operator>(vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vfloat operator==(vfloat a, vfloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline vfloat operator&(vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b) { return _mm_or_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline int movemask(vfloat mask) { return _mm_movemask_ps(mask.v); }
+
+inline float reduce_min(vfloat a) {
+	__m128 m = _mm_min_ps(a.v, _mm_movehl_ps(a.v, a.v));
+	m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+	return _mm_cvtss_f32(m);
+}
+#endif
+
+#ifdef SIMD_SCALAR
+// plain arrays, a mask lane is 1 when true and 0 when false
+struct vfloat {
+	real v[simd_width];
+
+	vfloat() {}
+	vfloat(real f) { for (int i = 0; i < simd_width; i++) v[i] = f; }
+	static vfloat load(const real* p) { vfloat r; for (int i = 0; i < simd_width; i++) r.v[i] = p[i]; return r; }
+	void store(real* p) const { for (int i = 0; i < simd_width; i++) p[i] = v[i]; }
+};
+
+#define SIMD_SCALAR_OP(op, expr) \
+	inline vfloat op(vfloat a, vfloat b) { vfloat r; for (int i = 0; i < simd_width; i++) r.v[i] = (expr); return r; }
+SIMD_SCALAR_OP(operator+, a.v[i] + b.v[i])
+SIMD_SCALAR_OP(operator-, a.v[i] - b.v[i])
+SIMD_SCALAR_OP(operator*, a.v[i] * b.v[i])
+SIMD_SCALAR_OP(operator/, a.v[i] / b.v[i])
+SIMD_SCALAR_OP(operator<, a.v[i] < b.v[i])
+SIMD_SCALAR_OP(operator<=, a.v[i] <= b.v[i])
+SIMD_SCALAR_OP(operator>, a.v[i] > b.v[i])
+SIMD_SCALAR_OP(operator>=, a.v[i] >= b.v[i])
+SIMD_SCALAR_OP(operator==, a.v[i] == b.v[i])
+SIMD_SCALAR_OP(operator&, a.v[i] != 0 && b.v[i] != 0)
+SIMD_SCALAR_OP(operator|, a.v[i] != 0 || b.v[i] != 0)
+SIMD_SCALAR_OP(vmin, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+SIMD_SCALAR_OP(vmax, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef SIMD_SCALAR_OP
+
+inline vfloat vabs(vfloat a) { vfloat r; for (int i = 0; i < simd_width; i++) r.v[i] = a.v[i] < 0 ? -a.v[i] : a.v[i]; return r; }
+inline vfloat vsqrt(vfloat a) { vfloat r; for (int i = 0; i < simd_width; i++) r.v[i] = std::sqrt(a.v[i]); return r; }
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { vfloat r; for (int i = 0; i < simd_width; i++) r.v[i] = mask.v[i] != 0 ? a.v[i] : b.v[i]; return r; }
+inline int movemask(vfloat mask) { int m = 0; for (int i = 0; i < simd_width; i++) m |= (mask.v[i] != 0) << i; return m; }
+inline real reduce_min(vfloat a) { real m = a.v[0]; for (int i = 1; i < simd_width; i++) m = a.v[i] < m ? a.v[i] : m; return m; }
+#endif
+
+// the lane of the lowest set bit in a mask
+inline int first_lane(int mask) { return __builtin_ctz(mask); }
+
+#endif
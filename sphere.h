@@ -8,21 +8,24 @@
 class sphere: public hittable {
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {
+        sphere(point3 cen, real r, shared_ptr<material> m) : center(cen), radius(r), mat_id(scene_materials.add(m)) {
         	centroid = center;
         };
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
         virtual aabb bounding_box() const;
-        bool hit(const ray& r, double t_min, double t_max, hit_record& rec);
+
+        // only the distance, the hit record is filled by set_hit_record for the closest hit
+        bool intersect(const ray& r, real t_min, real t_max, real& t) const;
+        void set_hit_record(const ray& r, real t, hit_record& rec) const;
 
     public:
         point3 center;
-        double radius;
-        shared_ptr<material> mat_ptr;
+        real radius;
+        uint32_t mat_id;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::intersect(const ray& r, real t_min, real t_max, real& t) const {
     auto oc = r.origin() - center;
 	auto a = r.direction().squared_length();
 	auto half_b = dot(r.direction(), oc);
@@ -33,26 +36,36 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 		auto root = sqrt(discriminant);
 		auto temp = (-half_b - root) / a;
 		if (temp < t_max && temp > t_min) {
-			rec.t = temp;
-			rec.p = r.at(rec.t);
-			vec3 outward_normal = (rec.p - center) / radius;
-			rec.set_face_normal(r, outward_normal);
-			rec.mat_ptr = mat_ptr;
+			t = temp;
 			return true;
 		}
 		temp = (-half_b + root) / a;
 		if (temp < t_max && temp > t_min) {
-			rec.t = temp;
-			rec.p = r.at(rec.t);
-			vec3 outward_normal = (rec.p - center) / radius;
-			rec.set_face_normal(r, outward_normal);
-			rec.mat_ptr = mat_ptr;
+			t = temp;
 			return true;
 		}
 	}
 	return false;
 }
 
+void sphere::set_hit_record(const ray& r, real t, hit_record& rec) const {
+	rec.t = t;
+	vec3 outward_normal = (r.at(t) - center) / radius;
+	// project the hit point back on the sphere to remove the error of r.at(t)
+	rec.p = center + radius * unit_vector(outward_normal);
+	rec.set_face_normal(r, outward_normal);
+	rec.mat_id = mat_id;
+}
+
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	real t;
+	if (!intersect(r, t_min, t_max, t))
+		return false;
+
+	set_hit_record(r, t, rec);
+	return true;
+}
+
 aabb sphere::bounding_box() const {
 	return aabb(
 		center - vec3(radius, radius, radius), 
@@ -0,0 +1,71 @@
+#ifndef SPHERE_BLOCK_H
+#define SPHERE_BLOCK_H
+
+#include <limits>
+
+#include "rtweekend.h"
+#include "simd.h"
+
+// Up to simd_width spheres stored as structure of arrays, so one ray is tested
+// against all of them at once. Unused lanes have a NaN center and are never hit.
+// prim holds an id per lane to find the sphere (and its material) back for the
+// hit record.
+struct alignas(32) sphere_block {
+	real center[3][simd_width];
+	real radius2[simd_width];
+	uint32_t prim[simd_width];
+
+	sphere_block() {
+		for (int i = 0; i < simd_width; i++) {
+			for (int k = 0; k < 3; k++)
+				center[k][i] = std::numeric_limits<real>::quiet_NaN();
+			radius2[i] = 0;
+			prim[i] = 0;
+		}
+	}
+
+	void set(int lane, const point3& c, real radius, uint32_t id) {
+		for (int k = 0; k < 3; k++)
+			center[k][lane] = c[k];
+		radius2[lane] = radius * radius;
+		prim[lane] = id;
+	}
+};
+
+// The same quadratic as sphere::intersect for all lanes of a block. The near root
+// is used when it is in (t_min, t_max), otherwise the far one. Returns the lane of
+// the nearest hit with its distance, or -1.
+inline int intersect_sphere_block(const sphere_block& b, const ray& r, real t_min, real t_max, real& t) {
+	const vfloat dx(r.dir[0]), dy(r.dir[1]), dz(r.dir[2]);
+	const vfloat a(r.dir.squared_length());
+
+	// oc = orig - center
+	const auto ox = vfloat(r.orig[0]) - vfloat::load(b.center[0]);
+	const auto oy = vfloat(r.orig[1]) - vfloat::load(b.center[1]);
+	const auto oz = vfloat(r.orig[2]) - vfloat::load(b.center[2]);
+
+	const auto half_b = dx*ox + dy*oy + dz*oz;
+	const auto c = ox*ox + oy*oy + oz*oz - vfloat::load(b.radius2);
+	const auto discriminant = half_b*half_b - a*c;
+
+	// sqrt of a negative discriminant gives NaN, those lanes are masked out below
+	const auto root = vsqrt(discriminant);
+	const auto t_near = (vfloat(0) - half_b - root) / a;
+	const auto t_far = (vfloat(0) - half_b + root) / a;
+
+	const vfloat lo(t_min), hi(t_max);
+	const auto near_ok = (t_near > lo) & (t_near < hi);
+	const auto far_ok = (t_far > lo) & (t_far < hi);
+	const auto mask = (discriminant > vfloat(0)) & (near_ok | far_ok);
+	if (movemask(mask) == 0)
+		return -1;
+
+	const auto t_lanes = select(mask, select(near_ok, t_near, t_far), vfloat(infinity));
+	const auto t_nearest = reduce_min(t_lanes);
+	const auto lane = first_lane(movemask(mask & (t_lanes == vfloat(t_nearest))));
+
+	t = t_nearest;
+	return lane;
+}
+
+#endif
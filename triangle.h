@@ -7,79 +7,139 @@
 #include "material.h"
 
 
+// ray-triangle intersection shared by all triangle types, returns the distance
+// and the barycentric coordinates of the hit
+inline bool intersect_triangle(
+	const point3& v0,
+	const point3& v1,
+	const point3& v2,
+	const ray& r,
+	real t_min,
+	real t_max,
+	real& t,
+	real& u,
+	real& v)
+{
+	D(num_ray_triangle_tests++);
+	// Moller Trumbore algorithm 
+	vec3 v0v1 = v1 - v0; 
+	vec3 v0v2 = v2 - v0; 
+	vec3 pvec = cross(r.direction(), v0v2); 
+	real det = dot(v0v1, pvec);
+
+	// ray and triangle are parallel if det is close to 0
+	if (std::abs(det) < kEpsilon)
+		return false;
+
+	real invDet = 1 / det; 
+
+	vec3 tvec = r.origin() - v0; 
+	u = dot(tvec, pvec) * invDet; 
+	if (u < 0 || u > 1)
+		return false;
+
+	vec3 qvec = cross(tvec, v0v1); 
+	v = dot(r.direction(), qvec) * invDet; 
+	if (v < 0 || u + v > 1)
+		return false;
+
+	t = dot(v0v2, qvec) * invDet;
+	if (t < t_min || t > t_max)
+		return false;
+
+	D(num_ray_triangle_intersections++);
+	return true;
+}
+
+// fill the hit record from the distance and barycentric coordinates of a hit. The hit
+// point is computed from the barycentric coordinates, r.at(t) has an error that
+// grows with the distance to the origin.
+inline void set_triangle_hit_record(
+	const point3& v0,
+	const point3& v1,
+	const point3& v2,
+	uint32_t mat_id,
+	const ray& r,
+	real t,
+	real u,
+	real v,
+	hit_record& rec)
+{
+	vec3 v0v1 = v1 - v0;
+	vec3 v0v2 = v2 - v0;
+	rec.t = t;
+	rec.p = v0 + u*v0v1 + v*v0v2;
+	vec3 outward_normal = unit_vector(cross(v0v1, v0v2));
+	rec.set_face_normal(r, outward_normal);
+	rec.mat_id = mat_id;
+}
+
+inline bool hit_triangle(
+	const point3& v0,
+	const point3& v1,
+	const point3& v2,
+	uint32_t mat_id,
+	const ray& r,
+	real t_min,
+	real t_max,
+	hit_record& rec)
+{
+	real t, u, v;
+	if (!intersect_triangle(v0, v1, v2, r, t_min, t_max, t, u, v))
+		return false;
+
+	set_triangle_hit_record(v0, v1, v2, mat_id, r, t, u, v, rec);
+	return true;
+}
+
+// bounding box of a triangle, made a little bigger on the dimensions where it is flat
+inline aabb triangle_bounding_box(const point3& v0, const point3& v1, const point3& v2) {
+	point3 small(
+		std::min(v0.x(), std::min(v1.x(), v2.x())),
+		std::min(v0.y(), std::min(v1.y(), v2.y())),
+		std::min(v0.z(), std::min(v1.z(), v2.z())));
+
+	point3 big(
+		std::max(v0.x(), std::max(v1.x(), v2.x())),
+		std::max(v0.y(), std::max(v1.y(), v2.y())),
+		std::max(v0.z(), std::max(v1.z(), v2.z())));
+
+	// if the bounding box is to small on one of the dimensions
+	// make it a little bigger on that dimension
+	auto delta = big - small;
+	for (int i = 0; i < 3; ++i) {
+		if (delta.e[i] < kEpsilon)
+			big.e[i] = small.e[i] + kEpsilon;
+	}
+
+	return aabb(small, big);
+}
+
+
 class triangle: public hittable {
     public:
         triangle() {}
-        triangle(point3 v0, point3 v1, point3 v2, shared_ptr<material> m) : v0(v0), v1(v1), v2(v2), mat_ptr(m) {
+        triangle(point3 v0, point3 v1, point3 v2, shared_ptr<material> m) : v0(v0), v1(v1), v2(v2), mat_id(scene_materials.add(m)) {
         	centroid = (v0 + v1 + v2) / 3;
         };
 
-        bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-			D(num_ray_triangle_tests++);
-			// Moller Trumbore algorithm 
-			vec3 v0v1 = v1 - v0; 
-			vec3 v0v2 = v2 - v0; 
-			vec3 pvec = cross(r.direction(), v0v2); 
-			double det = dot(v0v1, pvec);
-
-			// ray and triangle are parallel if det is close to 0
-			if (fabs(det) < kEpsilon)
-				return false;
-
-			double invDet = 1 / det; 
-
-			vec3 tvec = r.origin() - v0; 
-			auto u = dot(tvec, pvec) * invDet; 
-			if (u < 0 || u > 1)
-				return false;
-
-			vec3 qvec = cross(tvec, v0v1); 
-			auto v = dot(r.direction(), qvec) * invDet; 
-			if (v < 0 || u + v > 1)
-				return false;
-
-			auto temp = dot(v0v2, qvec) * invDet;
-			if (temp < t_min || temp > t_max)
-				return false;
-
-			// set hit record details
-			rec.t = temp;
-			rec.p = r.at(rec.t);
-			vec3 outward_normal = unit_vector(cross(v0v1, v0v2));
-			rec.set_face_normal(r, outward_normal);
-			rec.mat_ptr = mat_ptr;
-
-			D(num_ray_triangle_intersections++);
-			return true;
+        bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+			return hit_triangle(v0, v1, v2, mat_id, r, t_min, t_max, rec);
+		}
+
+        void set_hit_record(const ray& r, real t, real u, real v, hit_record& rec) const {
+			set_triangle_hit_record(v0, v1, v2, mat_id, r, t, u, v, rec);
 		}
 
         aabb bounding_box() const {
-			point3 small(
-				fmin(v0.x(), fmin(v1.x(), v2.x())),
-				fmin(v0.y(), fmin(v1.y(), v2.y())),
-				fmin(v0.z(), fmin(v1.z(), v2.z())));
-
-			point3 big(
-				fmax(v0.x(), fmax(v1.x(), v2.x())),
-				fmax(v0.y(), fmax(v1.y(), v2.y())),
-				fmax(v0.z(), fmax(v1.z(), v2.z())));
-
-			// if the bounding box is to small on one of the dimensions
-			// make it a little bigger on that dimension
-			auto delta = big - small;
-			for (int i = 0; i < 3; ++i) {
-				if (delta.e[i] < kEpsilon)
-					big.e[i] = small.e[i] + kEpsilon;
-			}
-
-			return aabb(small, big);
+			return triangle_bounding_box(v0, v1, v2);
 		}
 
     public:
         point3 v0;
         point3 v1;
         point3 v2;
-        shared_ptr<material> mat_ptr;
+        uint32_t mat_id;
 };
 
 #endif
\ No newline at end of file
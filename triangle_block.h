@@ -0,0 +1,94 @@
+#ifndef TRIANGLE_BLOCK_H
+#define TRIANGLE_BLOCK_H
+
+#include "rtweekend.h"
+#include "simd.h"
+
+class triangle_mesh;
+
+// Up to simd_width triangles of one mesh stored as structure of arrays with the
+// edges precomputed, so one ray is tested against all of them at once. Unused
+// lanes have zero edges and are never hit. prim holds the triangle index in mesh
+// per lane to find the triangle back for the hit record.
+struct alignas(32) triangle_block {
+	real v0[3][simd_width];
+	real e1[3][simd_width];
+	real e2[3][simd_width];
+	uint32_t prim[simd_width];
+	const triangle_mesh* mesh = nullptr;
+
+	triangle_block() {
+		for (int k = 0; k < 3; k++) {
+			for (int i = 0; i < simd_width; i++) {
+				v0[k][i] = 0;
+				e1[k][i] = 0;
+				e2[k][i] = 0;
+			}
+		}
+		for (int i = 0; i < simd_width; i++)
+			prim[i] = 0;
+	}
+
+	void set(int lane, const point3& a, const point3& b, const point3& c, uint32_t id) {
+		for (int k = 0; k < 3; k++) {
+			v0[k][lane] = a[k];
+			e1[k][lane] = b[k] - a[k];
+			e2[k][lane] = c[k] - a[k];
+		}
+		prim[lane] = id;
+	}
+};
+
+// Moller Trumbore for all lanes of a block. Returns the lane of the nearest hit in
+// [t_min, t_max] with its distance and barycentric coordinates, or -1.
+inline int intersect_triangle_block(const triangle_block& b, const ray& r, real t_min, real t_max, real& t, real& u, real& v) {
+	D(num_ray_triangle_tests += simd_width);
+
+	const vfloat dx(r.dir[0]), dy(r.dir[1]), dz(r.dir[2]);
+	const auto e1x = vfloat::load(b.e1[0]), e1y = vfloat::load(b.e1[1]), e1z = vfloat::load(b.e1[2]);
+	const auto e2x = vfloat::load(b.e2[0]), e2y = vfloat::load(b.e2[1]), e2z = vfloat::load(b.e2[2]);
+
+	// pvec = cross(dir, e2)
+	const auto px = dy*e2z - dz*e2y;
+	const auto py = dz*e2x - dx*e2z;
+	const auto pz = dx*e2y - dy*e2x;
+	const auto det = e1x*px + e1y*py + e1z*pz;
+	const auto inv_det = vfloat(1) / det;
+
+	// tvec = orig - v0
+	const auto tx = vfloat(r.orig[0]) - vfloat::load(b.v0[0]);
+	const auto ty = vfloat(r.orig[1]) - vfloat::load(b.v0[1]);
+	const auto tz = vfloat(r.orig[2]) - vfloat::load(b.v0[2]);
+	const auto uu = (tx*px + ty*py + tz*pz) * inv_det;
+
+	// qvec = cross(tvec, e1)
+	const auto qx = ty*e1z - tz*e1y;
+	const auto qy = tz*e1x - tx*e1z;
+	const auto qz = tx*e1y - ty*e1x;
+	const auto vv = (dx*qx + dy*qy + dz*qz) * inv_det;
+	const auto tt = (e2x*qx + e2y*qy + e2z*qz) * inv_det;
+
+	// the compares are false for the NaNs of the empty lanes
+	const auto mask = (vabs(det) >= vfloat(kEpsilon))
+		& (uu >= vfloat(0)) & (vv >= vfloat(0)) & (uu + vv <= vfloat(1))
+		& (tt >= vfloat(t_min)) & (tt <= vfloat(t_max));
+	if (movemask(mask) == 0)
+		return -1;
+
+	const auto t_masked = select(mask, tt, vfloat(infinity));
+	const auto t_nearest = reduce_min(t_masked);
+	const auto lane = first_lane(movemask(mask & (t_masked == vfloat(t_nearest))));
+
+	alignas(32) real lanes_u[simd_width];
+	alignas(32) real lanes_v[simd_width];
+	uu.store(lanes_u);
+	vv.store(lanes_v);
+	t = t_nearest;
+	u = lanes_u[lane];
+	v = lanes_v[lane];
+
+	D(num_ray_triangle_intersections++);
+	return lane;
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "triangle.h"
+#include "material.h"
+
+// A read only view of an array the mesh does not necessarily own.
+template <typename T>
+struct array_view {
+	const T* ptr = nullptr;
+	size_t count = 0;
+
+	array_view() {}
+	array_view(const T* ptr, size_t count) : ptr(ptr), count(count) {}
+	array_view(const std::vector<T>& v) : ptr(v.data()), count(v.size()) {}
+
+	const T& operator[](size_t i) const { return ptr[i]; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + count; }
+};
+
+// A triangle mesh with a shared vertex buffer. Triangle i uses the vertices
+// indices[3*i], indices[3*i + 1] and indices[3*i + 2]. The whole mesh has one
+// material. The optional normals are per vertex and use the same indices; when
+// they are there they are interpolated for smooth shading.
+// A bvh references the triangles of a mesh by index, so they are not copied.
+//
+// The mesh reads its arrays through views. They point into the vectors it owns, or
+// into memory owned by someone else (like a mapped mesh file), backing keeps that
+// memory alive. Such a mesh can be scaled and moved without copying its vertices,
+// they are transformed when they are read.
+//
+// quantize() replaces the vertex buffer by 16 bit integer positions relative to the
+// bounding box of the mesh, half the memory (6 bytes per vertex instead of 12). The
+// vertices are decoded when a triangle is intersected, so the mesh is the decoded
+// one from then on and the triangle bounds are computed from the decoded vertices too.
+class triangle_mesh: public hittable {
+	public:
+		triangle_mesh() {}
+		triangle_mesh(
+			std::vector<point3> vertices,
+			std::vector<uint32_t> indices,
+			shared_ptr<material> m,
+			std::vector<vec3> normals = {})
+			: vertex_storage(std::move(vertices)), index_storage(std::move(indices)), normal_storage(std::move(normals)),
+			  vertices(vertex_storage), indices(index_storage), normals(normal_storage), mat_id(scene_materials.add(m))
+		{
+			for (const auto& v : this->vertices)
+				box = surrounding_box(box, v);
+			centroid = (box.min() + box.max()) / 2;
+		}
+
+		// A mesh on memory it does not own, the box of the untransformed vertices is
+		// passed in so the vertices are not touched. The vertices are scaled by scale
+		// and then moved by pos.
+		triangle_mesh(
+			shared_ptr<const void> backing,
+			array_view<point3> vertices,
+			array_view<uint32_t> indices,
+			array_view<vec3> normals,
+			aabb box,
+			shared_ptr<material> m,
+			real scale = 1,
+			point3 pos = point3(0, 0, 0))
+			: vertices(vertices), indices(indices), normals(normals), scale(scale), pos(pos), mat_id(scene_materials.add(m)), backing(std::move(backing))
+		{
+			this->box = surrounding_box(aabb(position_of(box.min()), position_of(box.min())), position_of(box.max()));
+			centroid = (this->box.min() + this->box.max()) / 2;
+		}
+
+		// the views point into the mesh itself
+		triangle_mesh(const triangle_mesh&) = delete;
+		triangle_mesh& operator=(const triangle_mesh&) = delete;
+
+		size_t triangle_count() const { return indices.size() / 3; }
+
+		bool quantized() const { return !qvertices.empty(); }
+
+		point3 vertex(uint32_t tri, int k) const {
+			const auto idx = indices[3*tri + k];
+			if (quantized())
+				return decode(qvertices[idx]);
+			return position_of(vertices[idx]);
+		}
+
+		// Store the vertices as 16 bit integers on a grid over the bounding box. Returns
+		// the largest distance of a decoded vertex to the original one.
+		real quantize() {
+			if (vertices.empty() || quantized())
+				return 0;
+
+			constexpr real levels = 65535;
+			qorigin = box.min();
+			auto extent = box.max() - box.min();
+			for (int k = 0; k < 3; k++)
+				qstep.e[k] = extent[k] > 0 ? extent[k] / levels : 0;
+
+			qvertices.resize(vertices.size());
+			for (size_t i = 0; i < vertices.size(); i++) {
+				const auto v = position_of(vertices[i]);
+				for (int k = 0; k < 3; k++) {
+					auto q = qstep[k] > 0 ? std::round((v[k] - qorigin[k]) / qstep[k]) : 0;
+					qvertices[i][k] = (uint16_t)std::clamp(q, real(0), levels);
+				}
+			}
+
+			real max_error = 0;
+			for (size_t i = 0; i < vertices.size(); i++)
+				max_error = std::max(max_error, (decode(qvertices[i]) - position_of(vertices[i])).length());
+
+			// the decoded vertices can be a little outside the original box
+			box = aabb();
+			for (const auto& q : qvertices)
+				box = surrounding_box(box, decode(q));
+
+			std::cout << "quantized " << vertices.size() << " vertices to 16 bit, max error " << max_error
+				<< " (" << max_error / extent.length() << " of the box diagonal)\n";
+
+			vertices = {};
+			std::vector<point3>().swap(vertex_storage);
+			return max_error;
+		}
+
+		point3 triangle_centroid(uint32_t tri) const {
+			return (vertex(tri, 0) + vertex(tri, 1) + vertex(tri, 2)) / 3;
+		}
+
+		aabb triangle_bounding_box(uint32_t tri) const {
+			return ::triangle_bounding_box(vertex(tri, 0), vertex(tri, 1), vertex(tri, 2));
+		}
+
+		bool intersect(uint32_t tri, const ray& r, real t_min, real t_max, real& t, real& u, real& v) const {
+			return intersect_triangle(vertex(tri, 0), vertex(tri, 1), vertex(tri, 2), r, t_min, t_max, t, u, v);
+		}
+
+		bool hit_triangle(uint32_t tri, const ray& r, real t_min, real t_max, hit_record& rec) const {
+			const auto v0 = vertex(tri, 0);
+			const auto v1 = vertex(tri, 1);
+			const auto v2 = vertex(tri, 2);
+
+			real t, u, v;
+			if (!intersect_triangle(v0, v1, v2, r, t_min, t_max, t, u, v))
+				return false;
+
+			set_hit_record(tri, r, t, u, v, rec);
+			return true;
+		}
+
+		// fill the hit record from the distance and barycentric coordinates of a hit
+		void set_hit_record(uint32_t tri, const ray& r, real t, real u, real v, hit_record& rec) const {
+			const auto v0 = vertex(tri, 0);
+			vec3 v0v1 = vertex(tri, 1) - v0;
+			vec3 v0v2 = vertex(tri, 2) - v0;
+			rec.t = t;
+			rec.p = v0 + u*v0v1 + v*v0v2;
+			rec.set_face_normal(r, unit_vector(cross(v0v1, v0v2)));
+			rec.mat_id = mat_id;
+
+			if (!normals.empty()) {
+				// the shading normal is flipped to the same side as the geometric normal,
+				// which stays in geometric_normal to offset the next ray
+				const auto* idx = &indices[3*tri];
+				vec3 n = unit_vector((1 - u - v)*normals[idx[0]] + u*normals[idx[1]] + v*normals[idx[2]]);
+				rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+			}
+		}
+
+		// without a bvh all triangles are tested, the hit record is filled once for the closest
+		bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+			uint32_t closest = 0;
+			real closest_u = 0, closest_v = 0;
+			bool hit_anything = false;
+			for (uint32_t i = 0; i < triangle_count(); i++) {
+				real t, u, v;
+				if (intersect(i, r, t_min, t_max, t, u, v)) {
+					hit_anything = true;
+					closest = i;
+					closest_u = u;
+					closest_v = v;
+					t_max = t;
+				}
+			}
+			if (hit_anything)
+				set_hit_record(closest, r, t_max, closest_u, closest_v, rec);
+			return hit_anything;
+		}
+
+		aabb bounding_box() const { return box; }
+
+	private:
+		point3 position_of(const point3& v) const {
+			return scale * v + pos;
+		}
+
+		point3 decode(const std::array<uint16_t, 3>& q) const {
+			return qorigin + vec3(q[0] * qstep.x(), q[1] * qstep.y(), q[2] * qstep.z());
+		}
+
+	private:
+		std::vector<point3> vertex_storage;
+		std::vector<uint32_t> index_storage;
+		std::vector<vec3> normal_storage;
+
+	public:
+		array_view<point3> vertices;
+		array_view<uint32_t> indices;
+		array_view<vec3> normals;
+		real scale = 1;              // applied to the vertices when they are read
+		point3 pos = point3(0, 0, 0);
+		std::vector<std::array<uint16_t, 3>> qvertices; // replaces vertices after quantize()
+		point3 qorigin;
+		vec3 qstep;
+		uint32_t mat_id;
+		aabb box;
+
+	private:
+		shared_ptr<const void> backing;
+};
+
+#endif
@@ -21,28 +21,28 @@
 class vec3  {
     public:
         vec3() {}
-        vec3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
-        inline float x() const { return e[0]; }
-        inline float y() const { return e[1]; }
-        inline float z() const { return e[2]; }
-        inline float r() const { return e[0]; }
-        inline float g() const { return e[1]; }
-        inline float b() const { return e[2]; }
+        vec3(real e0, real e1, real e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+        inline real x() const { return e[0]; }
+        inline real y() const { return e[1]; }
+        inline real z() const { return e[2]; }
+        inline real r() const { return e[0]; }
+        inline real g() const { return e[1]; }
+        inline real b() const { return e[2]; }
 
         inline const vec3& operator+() const { return *this; }
         inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        inline float operator[](int i) const { return e[i]; }
-        inline float& operator[](int i) { return e[i]; }
+        inline real operator[](int i) const { return e[i]; }
+        inline real& operator[](int i) { return e[i]; }
 
         inline vec3& operator+=(const vec3 &v2);
         inline vec3& operator-=(const vec3 &v2);
         inline vec3& operator*=(const vec3 &v2);
         inline vec3& operator/=(const vec3 &v2);
-        inline vec3& operator*=(const float t);
-        inline vec3& operator/=(const float t);
+        inline vec3& operator*=(const real t);
+        inline vec3& operator/=(const real t);
 
-        inline float length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
-        inline float squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+        inline real length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
+        inline real squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
         inline void make_unit_vector();
 
         inline static vec3 random() {
@@ -53,7 +53,7 @@ class vec3  {
             return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
         }
 
-        float e[3];
+        real e[3];
 };
 
 // Type aliases for vec3
@@ -72,7 +72,7 @@ inline std::ostream& operator<<(std::ostream &os, const vec3 &t) {
 }
 
 inline void vec3::make_unit_vector() {
-    float k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+    real k = 1 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
     e[0] *= k; e[1] *= k; e[2] *= k;
 }
 
@@ -92,19 +92,19 @@ inline vec3 operator/(const vec3 &v1, const vec3 &v2) {
     return vec3(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
 }
 
-inline vec3 operator*(float t, const vec3 &v) {
+inline vec3 operator*(real t, const vec3 &v) {
     return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline vec3 operator/(vec3 v, float t) {
+inline vec3 operator/(vec3 v, real t) {
     return vec3(v.e[0]/t, v.e[1]/t, v.e[2]/t);
 }
 
-inline vec3 operator*(const vec3 &v, float t) {
+inline vec3 operator*(const vec3 &v, real t) {
     return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline float dot(const vec3 &v1, const vec3 &v2) {
+inline real dot(const vec3 &v1, const vec3 &v2) {
     return v1.e[0] * v2.e[0]
          + v1.e[1] * v2.e[1]
          + v1.e[2] * v2.e[2];
@@ -144,15 +144,15 @@ inline vec3& vec3::operator-=(const vec3& v) {
     return *this;
 }
 
-inline vec3& vec3::operator*=(const float t) {
+inline vec3& vec3::operator*=(const real t) {
     e[0] *= t;
     e[1] *= t;
     e[2] *= t;
     return *this;
 }
 
-inline vec3& vec3::operator/=(const float t) {
-    float k = 1.0f/t;
+inline vec3& vec3::operator/=(const real t) {
+    real k = 1/t;
 
     e[0] *= k;
     e[1] *= k;
@@ -183,7 +183,7 @@ vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2*dot(v,n)*n;
 }
 
-vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
+vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
     // uv is the incoming ray, n is the normal
     // etai_over_etat is refractive index of ingoing medium divided over regractive index of outgoing medium
     auto cos_theta = dot(-uv, n);